@@ -0,0 +1,241 @@
+/*  Sampling allocation profiler, see allocprof.h. Live samples are kept in
+ *  an open-addressing table keyed on the block pointer (linear probing,
+ *  backward-shift deletion), in memory mapped directly from the OS so the
+ *  profiler never allocates from the heap it is watching. A recursion
+ *  guard keeps allocations made by backtrace() itself from being sampled.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "allocprof.h"
+
+#define DEFAULT_RATE (512 * 1024)
+#define MAX_FRAMES 32
+#define TABLE_SLOTS 32768  // power of two
+#define MAX_SAMPLES (TABLE_SLOTS / 2)
+#define SKIP_FRAMES 1  // allocprof_sample itself
+#define LINE_MAX_LEN 4096
+#define FRAME_MAX_LEN 128  // longest function name kept, with its '\0'
+
+typedef struct sample {
+    void *ptr;  // NULL = empty slot
+    size_t size;
+    size_t weight;  // bytes this sample stands for
+    int depth;
+    void *frames[MAX_FRAMES];
+} sample;
+
+long allocprof_countdown = 0;  // 0 makes the first allocation initialize
+uint16_t allocprof_live_filter[ALLOCPROF_FILTER_SIZE];
+
+static bool initialized;
+static bool enabled;
+static bool in_profiler;
+static volatile sig_atomic_t dump_requested;
+static const char *out_path;
+static double rate;
+static uint64_t rng_state = 88172645463325252ULL;
+static sample *table;
+static size_t nlive;
+
+/*  Function returns the next value of a xorshift64 generator
+ */
+static uint64_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/*  Function draws the number of bytes until the next sample from an
+ *  exponential distribution with mean rate
+ */
+static long next_interval(void) {
+    double u = (next_random() >> 11) * (1.0 / 9007199254740992.0);  // [0, 1)
+    return (long)(-log(1.0 - u) * rate) + 1;
+}
+
+static size_t table_slot(const void *ptr) {
+    uint64_t h = (uintptr_t)ptr * 0x9E3779B97F4A7C15ULL;
+    return (h >> 32) & (TABLE_SLOTS - 1);
+}
+
+/*  Function only flags the request: the countdown belongs to the allocation
+ *  path, so the dump waits for the next sample (or exit)
+ */
+static void handle_dump_signal(int sig) {
+    (void)sig;
+    dump_requested = 1;
+}
+
+static void dump_at_exit(void) {
+    allocprof_dump(NULL);
+}
+
+/*  Function reads the settings from the environment on the first sampled
+ *  call, and sets everything up if profiling is enabled
+ */
+static void init(void) {
+    initialized = true;
+    allocprof_countdown = LONG_MAX;
+    out_path = getenv("ALLOCPROF");
+    if (out_path == NULL || *out_path == '\0') {
+        return;
+    }
+    const char *rate_value = getenv("ALLOCPROF_RATE");
+    rate = (rate_value != NULL && atol(rate_value) > 0) ? atol(rate_value) : DEFAULT_RATE;
+    table = mmap(NULL, TABLE_SLOTS * sizeof(sample), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED) {
+        return;
+    }
+    rng_state ^= (uint64_t)getpid() << 32;
+
+    // backtrace() loads its unwinder (and allocates) on first use: do it now
+    void *frames[MAX_FRAMES];
+    backtrace(frames, MAX_FRAMES);
+
+    signal(SIGUSR2, handle_dump_signal);
+    atexit(dump_at_exit);
+    enabled = true;
+    allocprof_countdown = next_interval();
+}
+
+/*  Function records ptr as a sample when the countdown ran out within it.
+ *  Entries that were not picked that way record nothing, as they would bias
+ *  the profile: the first allocation (the countdown starts at 0 to run init)
+ *  and allocations made by the profiler itself. They only re-arm the
+ *  countdown; intervals are memoryless, so drawing a fresh one is fair.
+ */
+void allocprof_sample(void *ptr, size_t size) {
+    if (in_profiler) {
+        allocprof_countdown = enabled ? next_interval() : LONG_MAX;
+        return;
+    }
+    if (!initialized) {
+        in_profiler = true;
+        init();
+        in_profiler = false;
+        return;
+    }
+    in_profiler = true;
+    if (dump_requested) {
+        dump_requested = 0;
+        allocprof_dump(NULL);
+    }
+    if (!enabled) {
+        allocprof_countdown = LONG_MAX;
+        in_profiler = false;
+        return;
+    }
+
+    // Sampling stopped the count at some point within this block; a block
+    // of size bytes is picked with probability 1 - exp(-size / rate)
+    allocprof_countdown = next_interval();
+    if (nlive < MAX_SAMPLES && size > 0) {
+        size_t slot = table_slot(ptr);
+        while (table[slot].ptr != NULL && table[slot].ptr != ptr) {
+            slot = (slot + 1) & (TABLE_SLOTS - 1);
+        }
+        sample *s = &table[slot];
+        if (s->ptr == NULL) {
+            nlive++;
+            allocprof_live_filter[allocprof_filter_slot(ptr)]++;
+        }
+        s->ptr = ptr;
+        s->size = size;
+        s->weight = (size_t)(size / (1.0 - exp(-(double)size / rate)));
+        void *frames[MAX_FRAMES + SKIP_FRAMES];
+        int depth = backtrace(frames, MAX_FRAMES + SKIP_FRAMES) - SKIP_FRAMES;
+        s->depth = (depth > 0) ? depth : 0;
+        memcpy(s->frames, frames + SKIP_FRAMES, s->depth * sizeof(void *));
+    }
+    in_profiler = false;
+}
+
+void allocprof_forget(void *ptr) {
+    if (table == NULL) {
+        return;
+    }
+    size_t slot = table_slot(ptr);
+    while (table[slot].ptr != ptr) {
+        if (table[slot].ptr == NULL) {
+            return;  // another pointer in the same filter bucket
+        }
+        slot = (slot + 1) & (TABLE_SLOTS - 1);
+    }
+    allocprof_live_filter[allocprof_filter_slot(ptr)]--;
+    nlive--;
+
+    // Backward-shift deletion: pull later entries of the run into the hole
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & (TABLE_SLOTS - 1); table[next].ptr != NULL; next = (next + 1) & (TABLE_SLOTS - 1)) {
+        size_t home = table_slot(table[next].ptr);
+        if (((next - home) & (TABLE_SLOTS - 1)) >= ((next - hole) & (TABLE_SLOTS - 1))) {
+            table[hole] = table[next];
+            hole = next;
+        }
+    }
+    table[hole].ptr = NULL;
+}
+
+/*  Function writes the name of the function holding addr (or the address)
+ *  to out, which has room for FRAME_MAX_LEN bytes. Returns its length.
+ */
+static size_t format_frame(char *out, void *addr) {
+    Dl_info info;
+    int len;
+    if (dladdr(addr, &info) != 0 && info.dli_sname != NULL) {
+        len = snprintf(out, FRAME_MAX_LEN, "%s", info.dli_sname);
+    } else {
+        len = snprintf(out, FRAME_MAX_LEN, "0x%lx", (unsigned long)(uintptr_t)addr);
+    }
+    return (len < FRAME_MAX_LEN) ? len : FRAME_MAX_LEN - 1;
+}
+
+int allocprof_dump(const char *path) {
+    if (!enabled) {
+        return -1;
+    }
+    bool was_in_profiler = in_profiler;
+    in_profiler = true;
+    int fd = open((path != NULL) ? path : out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        in_profiler = was_in_profiler;
+        return -1;
+    }
+
+    int result = 0;
+    char line[LINE_MAX_LEN];
+    for (size_t slot = 0; slot < TABLE_SLOTS && result == 0; slot++) {
+        const sample *s = &table[slot];
+        if (s->ptr == NULL) {
+            continue;
+        }
+        // Folded stacks go from the outermost frame in
+        size_t len = 0;
+        for (int i = s->depth - 1; i >= 0 && len + 2 * FRAME_MAX_LEN < LINE_MAX_LEN; i--) {
+            len += format_frame(line + len, s->frames[i]);
+            if (i > 0) {
+                line[len++] = ';';
+            }
+        }
+        len += snprintf(line + len, FRAME_MAX_LEN, " %zu\n", s->weight);
+        if (write(fd, line, len) != (ssize_t)len) {
+            result = -1;
+        }
+    }
+    close(fd);
+    in_profiler = was_in_profiler;
+    return result;
+}
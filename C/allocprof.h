@@ -0,0 +1,62 @@
+/* File: allocprof.h
+ * -----------------
+ * Sampling allocation profiler for the heap allocators. Roughly one
+ * allocation per ALLOCPROF_RATE bytes allocated is sampled (intervals are
+ * drawn from an exponential distribution, so every byte is equally likely
+ * to trigger a sample); its call stack is recorded and tracked until the
+ * block is freed. The live samples are written as a folded-stack profile
+ * ("main;f;g <bytes>" per line, as read by flamegraph.pl) where each
+ * sample is weighted by the bytes it stands for.
+ *
+ * Enabled by setting ALLOCPROF to the output path. ALLOCPROF_RATE sets
+ * the mean sampling interval in bytes (default 512 KiB). The profile is
+ * written at exit, on allocprof_dump(), and after SIGUSR2 (at the next
+ * sample, since writing it from the signal handler is not safe).
+ * Link with -lm (and -rdynamic for function names in the profile).
+ *
+ * The hooks below are the allocator's fast path: one subtraction per
+ * allocation and one table load per free.
+ */
+
+#ifndef _allocprof_h
+#define _allocprof_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ALLOCPROF_FILTER_SIZE 4096  // power of two
+
+// Bytes left until the next sample; at or below 0 the slow path runs
+extern long allocprof_countdown;
+// Number of live samples per pointer hash bucket, to skip most frees
+extern uint16_t allocprof_live_filter[ALLOCPROF_FILTER_SIZE];
+
+void allocprof_sample(void *ptr, size_t size);
+void allocprof_forget(void *ptr);
+
+/* Writes the live samples to the ALLOCPROF path (or to path, if not NULL).
+ * Returns 0, or -1 on errors.
+ */
+int allocprof_dump(const char *path);
+
+static inline size_t allocprof_filter_slot(const void *ptr) {
+    return ((uintptr_t)ptr >> 3) & (ALLOCPROF_FILTER_SIZE - 1);
+}
+
+/* Call after ptr was allocated with size bytes.
+ */
+static inline void allocprof_malloc(void *ptr, size_t size) {
+    if (ptr != NULL && (allocprof_countdown -= (long)size) <= 0) {
+        allocprof_sample(ptr, size);
+    }
+}
+
+/* Call before ptr is freed (or moved by realloc).
+ */
+static inline void allocprof_free(void *ptr) {
+    if (allocprof_live_filter[allocprof_filter_slot(ptr)] != 0) {
+        allocprof_forget(ptr);
+    }
+}
+
+#endif
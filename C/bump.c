@@ -1,10 +1,12 @@
 /* File: bump.c
  * ------------
  * A "bump" allocator that allocates memory only by tacking on
- * at the end of the heap.  Free is a no-op: blocks are never coalesced
- * or reused.  Realloc is implemented using malloc/memcpy/free. Operations
- * are fast, but utilization is very poor. It is also missing
- * attention to robustness.
+ * at the end of the heap.  Only the most recent block can be freed or
+ * resized in place; other blocks are never coalesced or reused, and
+ * realloc of them is implemented using malloc/memcpy. Operations
+ * are fast, but utilization is very poor unless memory is used in LIFO
+ * scopes: bump_mark/bump_release (see bump.h) free everything allocated
+ * since a mark at once, which makes this a usable per-request arena.
  *
  * This shows the very simplest of approaches; there are better options!
  */
@@ -13,6 +15,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "./allocator.h"
+#include "./bump.h"
 #include "./debug_break.h"
 
 // how many bytes are printed per line in dump_heap
@@ -22,6 +25,7 @@
 static void *segment_start;
 static size_t segment_size;
 static size_t nused;
+static void *last_block;  // most recent block still in use, or NULL
 
 
 /* Function: myinit
@@ -33,6 +37,7 @@ bool myinit(void *heap_start, size_t heap_size) {
     segment_start = heap_start;
     segment_size = heap_size;
     nused = 0;
+    last_block = NULL;
     return true;
 }
 
@@ -58,28 +63,78 @@ void *mymalloc(size_t requested_size) {
     }
     void *ptr = (char *)segment_start + nused;
     nused += needed;
+    last_block = ptr;
     return ptr;
 }
 
 /* Function: myfree
  * ----------------
- * This function does nothing - fast!... but lame :(
+ * This function gives back the space of the most recent block, by moving the
+ * end of the heap back to its start. Freeing any other block does nothing.
+ * Only one level is undone: the block before it is not known.
  */
-void myfree(void *ptr) {}
+void myfree(void *ptr) {
+    if (ptr != NULL && ptr == last_block) {
+        nused = (char *)ptr - (char *)segment_start;
+        last_block = NULL;
+    }
+}
 
 /* Function: realloc
  * -----------------
- * This function satisfies requests for resizing previously-allocated memory
- * blocks by allocating a new block of the requested size and moving the
- * existing contents to that region.  It's not particularly efficient.
+ * This function resizes the most recent block in place by moving the end of
+ * the heap. Any other block is moved to a new block of the requested size;
+ * its size is not recorded, so all bytes from it up to the end of the heap
+ * (at most new_size) are copied.
  */
 void *myrealloc(void *old_ptr, size_t new_size) {
+    if (old_ptr == NULL) {
+        return mymalloc(new_size);
+    }
+    if (new_size == 0) {
+        myfree(old_ptr);
+        return NULL;
+    }
+    size_t old_offset = (char *)old_ptr - (char *)segment_start;
+    if (old_ptr == last_block) {
+        size_t needed = roundup(new_size, ALIGNMENT);
+        if (needed > segment_size - old_offset) {
+            return NULL;
+        }
+        nused = old_offset + needed;
+        return old_ptr;
+    }
+
+    size_t available = nused - old_offset;
     void *new_ptr = mymalloc(new_size);
-    memcpy(new_ptr, old_ptr, new_size);
-    myfree(old_ptr);
+    if (new_ptr != NULL) {
+        memcpy(new_ptr, old_ptr, (available < new_size) ? available : new_size);
+    }
     return new_ptr;
 }
 
+/* Function: bump_mark
+ * -------------------
+ * This function returns the current end of the heap, to be passed to
+ * bump_release later.
+ */
+bump_mark_t bump_mark(void) {
+    return nused;
+}
+
+/* Function: bump_release
+ * ----------------------
+ * This function frees every block allocated since mark was taken, by moving
+ * the end of the heap back to it. Marks must be released in LIFO order; a
+ * mark past the current end (already released) is ignored.
+ */
+void bump_release(bump_mark_t mark) {
+    if (mark <= nused) {
+        nused = mark;
+        last_block = NULL;
+    }
+}
+
 /* Function: validate_heap
  * -----------------------
  * This function checks for potential errors/inconsistencies in the heap data
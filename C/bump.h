@@ -0,0 +1,23 @@
+/* File: bump.h
+ * ------------
+ * LIFO scopes for the bump allocator. bump_mark records the current end of
+ * the heap; bump_release(mark) frees everything allocated after it at once.
+ * Scopes nest: release inner marks before outer ones.
+ */
+
+#ifndef _bump_h
+#define _bump_h
+
+#include <stddef.h>
+
+typedef size_t bump_mark_t;
+
+/* Returns a mark for the current end of the heap.
+ */
+bump_mark_t bump_mark(void);
+
+/* Frees every block allocated since mark was returned.
+ */
+void bump_release(bump_mark_t mark);
+
+#endif
@@ -0,0 +1,153 @@
+/*  Environment lookups: get_env_value for a single key, and an env_index
+ *  for many keys. The index table stores, per variable, its name hash and
+ *  a pointer to the "NAME=value" string in envp; slots hold entry index + 1
+ *  (0 = empty) and are probed linearly.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "env.h"
+#include "samples/prototypes.h"
+
+#define BATCH_SIZE 16  // keys hashed (and slots prefetched) before probing
+
+typedef struct env_entry {
+    uint64_t hash;
+    const char *var;  // "NAME=value" in envp
+    size_t name_len;
+} env_entry;
+
+struct env_index {
+    env_entry *entries;
+    uint32_t *slots;
+    size_t mask;  // number of slots - 1
+    const char **envp;  // for keys holding '=', which the table cannot match
+};
+
+/*  Function returns the value of the variable named key in envp, or NULL.
+ *  Only an exact name match counts: key "SH" does not match "SHELL=...".
+ */
+const char *get_env_value(const char *envp[], const char *key) {
+    size_t len = strlen(key);
+    for (int i = 0; envp[i] != NULL; i++) {
+        if (strncmp(envp[i], key, len) == 0 && envp[i][len] == '=') {
+            return envp[i] + len + 1;
+        }
+    }
+    return NULL;
+}
+
+/*  Function hashes a name with 64-bit FNV-1a
+ */
+static uint64_t hash_name(const char *name, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*  Function returns the entry for the name of len characters, or NULL
+ */
+static const env_entry *find_entry(const env_index *index, const char *name, size_t len, uint64_t hash) {
+    size_t slot = hash & index->mask;
+    while (index->slots[slot] != 0) {
+        const env_entry *entry = &index->entries[index->slots[slot] - 1];
+        if (entry->hash == hash && entry->name_len == len && memcmp(entry->var, name, len) == 0) {
+            return entry;
+        }
+        slot = (slot + 1) & index->mask;
+    }
+    return NULL;
+}
+
+env_index *env_index_build(const char *envp[]) {
+    size_t nvars = 0;
+    while (envp[nvars] != NULL) {
+        nvars++;
+    }
+    size_t nslots = 16;
+    while (nslots < 2 * nvars) {
+        nslots *= 2;
+    }
+
+    env_index *index = malloc(sizeof(env_index));
+    if (index == NULL) {
+        return NULL;
+    }
+    index->entries = malloc(nvars * sizeof(env_entry) + 1);
+    index->slots = calloc(nslots, sizeof(uint32_t));
+    if (index->entries == NULL || index->slots == NULL) {
+        env_index_free(index);
+        return NULL;
+    }
+    index->mask = nslots - 1;
+    index->envp = envp;
+
+    size_t nentries = 0;
+    for (size_t i = 0; i < nvars; i++) {
+        const char *equals = strchr(envp[i], '=');
+        if (equals == NULL) {
+            continue;  // never matched by get_env_value either
+        }
+        size_t len = equals - envp[i];
+        uint64_t hash = hash_name(envp[i], len);
+        if (find_entry(index, envp[i], len, hash) != NULL) {
+            continue;  // an earlier variable of the same name wins
+        }
+        env_entry *entry = &index->entries[nentries];
+        entry->hash = hash;
+        entry->var = envp[i];
+        entry->name_len = len;
+        size_t slot = hash & index->mask;
+        while (index->slots[slot] != 0) {
+            slot = (slot + 1) & index->mask;
+        }
+        index->slots[slot] = ++nentries;
+    }
+    return index;
+}
+
+const char *env_index_get(const env_index *index, const char *key) {
+    const char *values[1];
+    env_index_get_many(index, &key, 1, values);
+    return values[0];
+}
+
+/*  Keys are handled BATCH_SIZE at a time: all of a batch are hashed and
+ *  their first slots prefetched before any is probed, so the cache misses
+ *  of a large table overlap instead of being taken one after another.
+ */
+void env_index_get_many(const env_index *index, const char *keys[], size_t nkeys, const char *values[]) {
+    size_t lens[BATCH_SIZE];
+    uint64_t hashes[BATCH_SIZE];
+
+    for (size_t start = 0; start < nkeys; start += BATCH_SIZE) {
+        size_t nbatch = (nkeys - start < BATCH_SIZE) ? nkeys - start : BATCH_SIZE;
+        for (size_t i = 0; i < nbatch; i++) {
+            lens[i] = strlen(keys[start + i]);
+            hashes[i] = hash_name(keys[start + i], lens[i]);
+            __builtin_prefetch(&index->slots[hashes[i] & index->mask]);
+        }
+        for (size_t i = 0; i < nbatch; i++) {
+            const char *key = keys[start + i];
+            if (memchr(key, '=', lens[i]) != NULL) {
+                // "A=B" matches "A=B=..." by prefix, which the table cannot see
+                values[start + i] = get_env_value(index->envp, key);
+                continue;
+            }
+            const env_entry *entry = find_entry(index, key, lens[i], hashes[i]);
+            values[start + i] = (entry != NULL) ? entry->var + lens[i] + 1 : NULL;
+        }
+    }
+}
+
+void env_index_free(env_index *index) {
+    if (index != NULL) {
+        free(index->entries);
+        free(index->slots);
+        free(index);
+    }
+}
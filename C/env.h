@@ -0,0 +1,36 @@
+/* File: env.h
+ * -----------
+ * Index over an environment array for answering many get_env_value style
+ * lookups. The index is built once, in one pass over envp, into an
+ * open-addressing hash table keyed on variable names; lookups return
+ * pointers to the values inside envp without copying them. As with
+ * get_env_value, a key only matches a variable with exactly that name,
+ * and the first of several variables with the same name wins.
+ */
+
+#ifndef _env_h
+#define _env_h
+
+#include <stddef.h>
+
+typedef struct env_index env_index;
+
+/* Builds an index over envp, which must outlive it. Returns NULL if out
+ * of memory.
+ */
+env_index *env_index_build(const char *envp[]);
+
+/* Returns the value of variable key, or NULL if it is not set.
+ */
+const char *env_index_get(const env_index *index, const char *key);
+
+/* Looks up nkeys keys at once, storing the value of keys[i] (or NULL) in
+ * values[i].
+ */
+void env_index_get_many(const env_index *index, const char *keys[], size_t nkeys, const char *values[]);
+
+/* Frees the index. envp is not touched.
+ */
+void env_index_free(env_index *index);
+
+#endif
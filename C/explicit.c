@@ -7,9 +7,14 @@
 #include <stdio.h>
 #include <string.h>
 #include "./allocator.h"
+#include "./allocprof.h"
 #include "./debug_break.h"
+#include "./handle.h"
 #define FREE 0
 #define USED 1
+#define MOVABLE 2  // used block owned by a handle, which hcompact may move
+#define HANDLE_PREFIX ALIGNMENT  // payload prefix of a handle block: its handle id
+#define INITIAL_HANDLES 64
 
 /*  Struct definition for block headers.
  *  Includes pointers to previous free block and next free block
@@ -34,6 +39,24 @@ static void *g_heap_start;
 static void *g_heap_end;
 static size_t g_heap_size;
 
+/*  Struct definition for handle table entries.
+ *  block is the payload of the handle's block (NULL for an unused handle, whose
+ *  next_free then links the unused handles); locks counts unmatched hlock calls.
+ */
+typedef struct handle_entry {
+    void *block;
+    uint32_t locks;
+    uint32_t next_free;
+} handle_entry;
+
+// Handle table, itself a plain (never moved) heap block; handle 0 is never used
+static handle_entry *g_handles;
+static size_t g_handles_cap;
+static uint32_t g_first_free_handle;
+
+// Header where the next compaction step starts; blocks before it are compacted
+static void *g_compact_cursor;
+
 
 /*  Function: is_used
  *  -----------------
@@ -58,7 +81,7 @@ void create_header(size_t num, void *ptr, int status) {
  *  Function is_used to check if bit is on, if so, the bit is turned off to return the correct number.
  */
 size_t header_num(void *ptr) {
-    return is_used(ptr) ? (*(size_t *)ptr - 1) : *((size_t *)ptr);
+    return *(size_t *)ptr & ~(size_t)(USED | MOVABLE);
 }
 
 /*  Function: roundup
@@ -71,11 +94,29 @@ size_t roundup(size_t sz, size_t mult) {
 
 /* Function: toggle_free
  * ---------------------
- *  Helper function to toggle bit off (off = 0 = FREE).
+ *  Helper function to toggle bit off (off = 0 = FREE), dropping the MOVABLE bit too.
  */
 void toggle_free(void *ptr) {
-    *((size_t *)ptr) >>= 1;
-    *((size_t *)ptr) <<= 1;
+    *((size_t *)ptr) &= ~(size_t)(USED | MOVABLE);
+}
+
+/*  Function: is_movable
+ *  --------------------
+ *  Helper function that checks if a given block belongs to a handle.
+ */
+bool is_movable(void *ptr) {
+    return *((size_t *)ptr) & MOVABLE;
+}
+
+/*  Function: headerRemoved
+ *  -----------------------
+ *  Helper function called whenever the block header at header is merged into the
+ *  block at into. Keeps the compaction cursor on a header that still exists.
+ */
+void headerRemoved(void *header, void *into) {
+    if (g_compact_cursor == header) {
+        g_compact_cursor = into;
+    }
 }
 
 /*  Function: myinit
@@ -110,6 +151,12 @@ bool myinit(void *heap_start, size_t heap_size) {
     first_free_block = (block *)((char *)heap_start + HEADER_SIZE);
     first_free_block->prev = NULL;
     first_free_block->next = NULL;
+
+    // No handles yet, compaction starts at the beginning
+    g_handles = NULL;
+    g_handles_cap = 0;
+    g_first_free_handle = 0;
+    g_compact_cursor = heap_start;
     
     // Successful initialization
     return true;
@@ -206,20 +253,22 @@ void rewireNoAdd(block *cur_block) {
 }
 
 
-/*  Function: mymalloc
- *  ------------------
+/*  Function: allocBlock
+ *  --------------------
  *  Calls helper functions to rewire pointers depending on state of heap.
  *  rewireAdd inserts a block into the linked-list while rewireNoAdd only rewires.
  *  Function returns a heap-allocated pointer to memory. If no adequate size to conform
  *  to user's request, function returns NULL.
  */
-void *mymalloc(size_t requested_size) {
+void *allocBlock(size_t requested_size) {
     if (((requested_size > (g_heap_size - HEADER_SIZE))) | (requested_size == 0)) {
         return NULL;
     }
     // Compute minimum required size, required size for payload, initialize block struct 
+    // (a payload must be able to hold the free list pointers once freed)
     size_t min_size_reqd = roundup(requested_size, ALIGNMENT); 
-    size_t payload_size_reqd = roundup(requested_size, ALIGNMENT) + 3 * HEADER_SIZE;
+    min_size_reqd = (min_size_reqd < FREE_SIZE) ? FREE_SIZE : min_size_reqd;
+    size_t payload_size_reqd = min_size_reqd + 3 * HEADER_SIZE;
     block *cur_block = (block *)first_free_block;
 
     // Traverse list
@@ -285,50 +334,53 @@ void coalesceFree(block *tofree_block, void *tofree_header, size_t tofree_size,
     
     // Update header to include next free block then coalesce
     create_header(HEADER_SIZE + tofree_size + next_size, tofree_header, FREE);
+    headerRemoved(next_header, tofree_header);
     coalesce(tofree_block, next_block); 
 }
 
-/*  Function: regularFree
- *  ---------------------
- *  Helper function that performs regular freeing of a block -- no coalescing.
- *  Called by myfree, this function inserts a free block at the pointer provided
- *  by the user and rewires the pointers.
- *
+/*  Function: insertFree
+ *  --------------------
+ *  Helper function that links a free block into the free block list, which is kept
+ *  in address order. Handles an empty list and insertion at either end.
  */
-void regularFree(block *tofree_block, void *tofree_header) {
+void insertFree(block *tofree_block) {
+    block *prev_ptr = NULL;
     block *cur_ptr = first_free_block;
-    toggle_free(tofree_header);
-    
-    // Check
-    if (cur_ptr == NULL) {
-        breakpoint();
-        return;
-    }
-    
-    while (cur_ptr != NULL) {
-        if (cur_ptr > tofree_block) {
-            break;
-        }
+    while (cur_ptr != NULL && cur_ptr < tofree_block) {
+        prev_ptr = cur_ptr;
         cur_ptr = cur_ptr->next;
     }
-    
-    if (cur_ptr->prev == NULL) {
+
+    tofree_block->prev = prev_ptr;
+    tofree_block->next = cur_ptr;
+    if (prev_ptr == NULL) {
         first_free_block = tofree_block;
     } else {
-        cur_ptr->prev->next = tofree_block;
+        prev_ptr->next = tofree_block;
+    }
+    if (cur_ptr != NULL) {
+        cur_ptr->prev = tofree_block;
     }
+}
 
-    tofree_block->prev = cur_ptr->prev;
-    tofree_block->next = cur_ptr;
-    cur_ptr->prev = tofree_block;
+/*  Function: regularFree
+ *  ---------------------
+ *  Helper function that performs regular freeing of a block -- no coalescing.
+ *  Called by myfree, this function marks the block at the pointer provided
+ *  by the user free and inserts it in the free block list.
+ *
+ */
+void regularFree(block *tofree_block, void *tofree_header) {
+    toggle_free(tofree_header);
+    insertFree(tofree_block);
 }
 
-/*  Function: myfree
- *  ----------------
+/*  Function: freeBlock
+ *  -------------------
  *  Function calls helper functions regularFree and coalesceFree to free the provided block pointer.
  *
  */
-void myfree(void *ptr) {
+void freeBlock(void *ptr) {
     // Check pointer
     if (ptr == NULL) {
         return;
@@ -355,129 +407,333 @@ void myfree(void *ptr) {
     }
 }
 
-/*  Function: coalescePossible
- *  --------------------------
- *  Helper function that checks if it is possible to coalesce to the right of a given pointer.
- *  Called by myrealloc.
- *  Returns true if coalesce to the right is possible.
+/*  Function: splitBlock
+ *  --------------------
+ *  Helper function that trims the used block at ptr down to size bytes of payload.
+ *  Called by myrealloc. The rest becomes a free block (joined with the next block
+ *  if that one is free) when it is large enough to hold a header and a free block.
  */
-bool coalescePossible(void *ptr) {
+void splitBlock(void *ptr, size_t size) {
     void *cur_header = (void *)((char *)ptr - HEADER_SIZE);
     size_t cur_size = header_num(cur_header);
-    void *next_header = (void *)((char *)ptr + cur_size);
-    bool next_free = !is_used(next_header);
-    return (next_free) ? 1 : 0;
+    if (cur_size < size + MIN_ALLOC_SIZE) {
+        return;
+    }
+    create_header(size, cur_header, USED);
+
+    void *rest_header = (void *)((char *)ptr + size);
+    size_t rest_size = cur_size - size - HEADER_SIZE;
+    block *rest_block = (block *)((char *)rest_header + HEADER_SIZE);
+    void *next_header = (void *)((char *)rest_block + rest_size);
+    if (!is_used(next_header)) {
+        coalesceFree(rest_block, rest_header, rest_size, next_header, header_num(next_header));
+    } else {
+        create_header(rest_size, rest_header, FREE);
+        insertFree(rest_block);
+    }
 }
 
-/*  Function: coalesceReal
- *  ----------------------
- *  Helper function to coalesce to the right when reallocating memory.
- *  Called by myrealloc.
- */
-void coalesceReal(void *ptr) {
-    while (coalescePossible(ptr)) { 
-        // Current header information
-        void *cur_header = (void *)((char *)ptr - HEADER_SIZE);
-        size_t cur_size = header_num(cur_header);
-       
-        // Next header information
-        void *next_header = (void *)((char *)ptr + cur_size);
+/*  Function: absorbRight
+ *  ---------------------
+ *  Helper function that grows the used block at ptr over all free blocks directly
+ *  after it, taking them off the free block list. Called by myrealloc.
+ *  Returns the new payload size.
+ */
+size_t absorbRight(void *ptr) {
+    void *cur_header = (void *)((char *)ptr - HEADER_SIZE);
+    size_t cur_size = header_num(cur_header);
+    void *next_header = (void *)((char *)ptr + cur_size);
+    while (!is_used(next_header)) {
         size_t next_size = header_num(next_header);
-        block *next_block = (block *)((char *)next_header + HEADER_SIZE);
+        rewireNoAdd((block *)((char *)next_header + HEADER_SIZE));
+        headerRemoved(next_header, cur_header);
+        cur_size += HEADER_SIZE + next_size;
+        next_header = (void *)((char *)ptr + cur_size);
+    }
+    create_header(cur_size, cur_header, USED);
+    return cur_size;
+}
 
-        rewireNoAdd(next_block);  // rewire
-        
-        size_t updated_size = cur_size + next_size + HEADER_SIZE;
-        create_header(updated_size, cur_header, FREE);  // update header
-        ptr = (void *)((char *)ptr);
+/*  Function: leftNeighbor
+ *  ----------------------
+ *  Helper function that returns the free block directly before the block whose
+ *  header is at header, or NULL if that block is used. Since the free block list
+ *  is in address order, it is the last free block before header, if adjacent.
+ */
+block *leftNeighbor(void *header) {
+    block *left = NULL;
+    for (block *cur = first_free_block; cur != NULL && (void *)cur < header; cur = cur->next) {
+        left = cur;
     }
+    if (left == NULL) {
+        return NULL;
+    }
+    size_t left_size = header_num((char *)left - HEADER_SIZE);
+    return ((char *)left + left_size == (char *)header) ? left : NULL;
 }
 
-/*  Function: myrealloc
- *  -------------------
- *  Function that dynamically reallocates memory.
+/*  Function: reallocBlock
+ *  ----------------------
+ *  Function that dynamically reallocates memory, avoiding copies where it can:
+ *  shrinking splits the block in place, growing first takes over the free blocks
+ *  to the right, then the free block to the left (sliding the payload down), and
+ *  only then moves the payload to a new block. At most the old payload is copied.
  */
-void *myrealloc(void *old_ptr, size_t new_size) {
+void *reallocBlock(void *old_ptr, size_t new_size) {
     if (old_ptr == NULL) {
-        void *ptr = mymalloc(new_size);
-        return (ptr) ? ptr : NULL;
+        return allocBlock(new_size);
     }
     if (new_size == 0) {
+        freeBlock(old_ptr);
+        return NULL;
+    }
+    if (new_size > g_heap_size) {
         return NULL;
     }
+    size_t size_reqd = roundup(new_size, ALIGNMENT);
+    size_reqd = (size_reqd < FREE_SIZE) ? FREE_SIZE : size_reqd;
 
-    // Get current header information
     void *cur_header = (void *)((char *)old_ptr - HEADER_SIZE);
-    size_t cur_size = header_num(cur_header);
-    block *cur_block = (void *)((char *)cur_header + HEADER_SIZE);
-    
     size_t old_size = header_num(cur_header);
-    new_size = roundup(new_size, ALIGNMENT);
-    
-    void *next_header = (void *)((char *)old_ptr + cur_size);
-    block *next_block = (void *)((char *)next_header + HEADER_SIZE);
-    void *mem_ptr = cur_block;
-
-    // Realloc is NOT possible at current location
-    if (new_size > cur_size) {
-        // If coalescing is possible, coalesce all possible blocks
-        if (coalescePossible(next_block)) {
-            coalesceReal(next_block);
+
+    // CASE 1 - Fits already, give back the tail
+    if (size_reqd <= old_size) {
+        splitBlock(old_ptr, size_reqd);
+        return old_ptr;
+    }
+
+    // CASE 2 - Grow into the free blocks on the right
+    size_t cur_size = absorbRight(old_ptr);
+    if (cur_size >= size_reqd) {
+        splitBlock(old_ptr, size_reqd);
+        return old_ptr;
+    }
+
+    // CASE 3 - Grow into the free block on the left, sliding the payload down
+    block *left = leftNeighbor(cur_header);
+    if (left != NULL) {
+        void *left_header = (void *)((char *)left - HEADER_SIZE);
+        size_t total_size = header_num(left_header) + HEADER_SIZE + cur_size;
+        if (total_size >= size_reqd) {
+            rewireNoAdd(left);
+            create_header(total_size, left_header, USED);
+            headerRemoved(cur_header, left_header);
+            memmove(left, old_ptr, old_size);
+            splitBlock(left, size_reqd);
+            return left;
         }
-        void *temp_header = (void *)((char *)next_block - HEADER_SIZE);
-        size_t temp_size = header_num(temp_header);
-        
-        // Copy memory
-        if (temp_size > new_size) {
-            mem_ptr = mymalloc(new_size);
-            memmove(mem_ptr, old_ptr, new_size);
-            myfree(old_ptr);
+    }
+
+    // CASE 4 - Move to a new block; on failure the old block stays as it was
+    void *mem_ptr = allocBlock(new_size);
+    if (mem_ptr == NULL) {
+        splitBlock(old_ptr, old_size);
+        return NULL;
+    }
+    memcpy(mem_ptr, old_ptr, old_size);
+    freeBlock(old_ptr);
+    return mem_ptr;
+}
+
+/*  Functions: mymalloc, myfree, myrealloc
+ *  --------------------------------------
+ *  The allocator interface: the block functions above plus the allocation profiler
+ *  hooks (see allocprof.h), which cost one subtraction or one table load unless a
+ *  sample is taken. A reallocated block counts as a new allocation of new_size bytes.
+ */
+void *mymalloc(size_t requested_size) {
+    void *ptr = allocBlock(requested_size);
+    allocprof_malloc(ptr, requested_size);
+    return ptr;
+}
+
+void myfree(void *ptr) {
+    if (ptr != NULL) {
+        allocprof_free(ptr);
+    }
+    freeBlock(ptr);
+}
+
+void *myrealloc(void *old_ptr, size_t new_size) {
+    void *new_ptr = reallocBlock(old_ptr, new_size);
+    if (old_ptr != NULL && (new_ptr != NULL || new_size == 0)) {
+        allocprof_free(old_ptr);
+    }
+    allocprof_malloc(new_ptr, new_size);
+    return new_ptr;
+}
+
+/*  Function: newHandle
+ *  -------------------
+ *  Helper function that returns an unused handle, doubling the handle table when
+ *  all are taken. Returns 0 if the table cannot grow.
+ */
+handle newHandle(void) {
+    if (g_first_free_handle == 0) {
+        size_t cap = (g_handles_cap == 0) ? INITIAL_HANDLES : 2 * g_handles_cap;
+        handle_entry *handles = (cap <= UINT32_MAX) ? reallocBlock(g_handles, cap * sizeof(handle_entry)) : NULL;
+        if (handles == NULL) {
+            return 0;
+        }
+        // Chain the new entries so the lowest handle is handed out first
+        size_t first_new = (g_handles_cap == 0) ? 1 : g_handles_cap;
+        for (size_t i = cap - 1; i >= first_new; i--) {
+            handles[i].block = NULL;
+            handles[i].locks = 0;
+            handles[i].next_free = g_first_free_handle;
+            g_first_free_handle = i;
         }
+        g_handles = handles;
+        g_handles_cap = cap;
+    }
+    handle h = g_first_free_handle;
+    g_first_free_handle = g_handles[h].next_free;
+    return h;
+}
 
-        // If after coalescing it fits
-        if (new_size < temp_size) {
-            // Free current
-            regularFree(cur_block, cur_header);
-            //rewireNoAdd(cur_block);
-            block *new_next_block = (block *)((char *)cur_block + new_size + HEADER_SIZE);
-            if (cur_block->prev == NULL) {
-                first_free_block = new_next_block;
-            }
-            new_next_block->prev = cur_block->prev;
-            if (cur_block->next != NULL) {
-                new_next_block->next = cur_block->next->next;
-                cur_block->next->prev = new_next_block;
-            }
+/*  Function: validHandle
+ *  ---------------------
+ *  Helper function that checks if h is a handle currently in use.
+ */
+bool validHandle(handle h) {
+    return h != 0 && h < g_handles_cap && g_handles[h].block != NULL;
+}
 
-            // Update headers
-            void *new_next_header = (void *)((char *)cur_header + new_size + HEADER_SIZE);
-            create_header(new_size, cur_header, USED);
-            create_header(temp_size + cur_size - new_size, new_next_header, FREE);
-            return mem_ptr;
-        // If it doesn't fit, call mymalloc
-        } else {
-            mem_ptr = mymalloc(new_size);
-            if (mem_ptr) {
-                memmove(mem_ptr, old_ptr, new_size);
-                myfree(old_ptr);
-                return mem_ptr;
-            }
+/*  Function: halloc
+ *  ----------------
+ *  Function allocates a movable block: a used block with the MOVABLE bit set,
+ *  whose payload starts with its handle so hcompact can update the table.
+ */
+handle halloc(size_t size) {
+    if (size == 0 || size > g_heap_size) {
+        return 0;
+    }
+    handle h = newHandle();
+    if (h == 0) {
+        return 0;
+    }
+    void *payload = allocBlock(size + HANDLE_PREFIX);
+    if (payload == NULL) {
+        g_handles[h].next_free = g_first_free_handle;
+        g_first_free_handle = h;
+        return 0;
+    }
+    *(size_t *)((char *)payload - HEADER_SIZE) |= MOVABLE;
+    *(size_t *)payload = h;
+    g_handles[h].block = payload;
+    g_handles[h].locks = 0;
+    return h;
+}
+
+void *hlock(handle h) {
+    if (!validHandle(h)) {
+        return NULL;
+    }
+    g_handles[h].locks++;
+    return (char *)g_handles[h].block + HANDLE_PREFIX;
+}
+
+void hunlock(handle h) {
+    if (validHandle(h) && g_handles[h].locks > 0) {
+        g_handles[h].locks--;
+    }
+}
+
+void hfree(handle h) {
+    if (!validHandle(h)) {
+        return;
+    }
+    freeBlock(g_handles[h].block);
+    g_handles[h].block = NULL;
+    g_handles[h].locks = 0;
+    g_handles[h].next_free = g_first_free_handle;
+    g_first_free_handle = h;
+}
+
+/*  Function: mergeFreeRun
+ *  ----------------------
+ *  Helper function that merges the free blocks directly after the free block at
+ *  header into it. Called by hcompact. Returns the merged payload size.
+ */
+size_t mergeFreeRun(void *header) {
+    size_t size = header_num(header);
+    void *next_header = (char *)header + HEADER_SIZE + size;
+    while (!is_used(next_header)) {
+        rewireNoAdd((block *)((char *)next_header + HEADER_SIZE));
+        size += HEADER_SIZE + header_num(next_header);
+        create_header(size, header, FREE);
+        headerRemoved(next_header, header);
+        next_header = (char *)header + HEADER_SIZE + size;
+    }
+    return size;
+}
+
+/*  Function: hcompact
+ *  ------------------
+ *  Function that compacts the heap incrementally from g_compact_cursor on. For each
+ *  free block (hole) found, an unlocked handle block right after it slides down into
+ *  it, which moves the hole up past the block to merge with any free space there.
+ *  Plain and locked blocks are stepped over. The free list stays in address order
+ *  because the hole keeps its place among the free blocks as it moves.
+ */
+bool hcompact(size_t budget) {
+    if (g_compact_cursor == NULL) {
+        return true;
+    }
+    size_t work = 0;
+    bool moved_any = false;
+    while (work < budget) {
+        void *header = g_compact_cursor;
+        size_t size = header_num(header);
+        if (size == 0 && is_used(header)) {
+            g_compact_cursor = g_heap_start;  // end of heap: next pass from the start
+            return true;
         }
-    } else {  // Realloc IS possible at current location
-        // Check if there's enough space to create a header
-        if ((old_size - new_size) > MIN_ALLOC_SIZE) {
-            // Update header
-            create_header(new_size, cur_header, USED);
-            // Add new header
-            void *for_header = (void *)((char *)cur_header + HEADER_SIZE + new_size);
-            create_header(cur_size - new_size - HEADER_SIZE, for_header, FREE);
-            return cur_block;
-        // Do not create a header
+        work += HEADER_SIZE;
+        if (is_used(header)) {
+            g_compact_cursor = (char *)header + HEADER_SIZE + size;
+            continue;
+        }
+
+        // A hole: move the block after it down, if it is allowed to move
+        size = mergeFreeRun(header);
+        block *hole = (block *)((char *)header + HEADER_SIZE);
+        void *next_header = (char *)hole + size;
+        void *next_payload = (char *)next_header + HEADER_SIZE;
+        if (!is_movable(next_header) || g_handles[*(size_t *)next_payload].locks > 0) {
+            g_compact_cursor = next_header;
+            continue;
+        }
+        size_t moved = header_num(next_header);
+        if (moved_any && work + moved > budget) {
+            break;  // resume at this hole next step
+        }
+        block *prev = hole->prev;
+        block *next = hole->next;
+        handle h = *(size_t *)next_payload;
+        memmove(hole, next_payload, moved);
+        create_header(moved, header, USED | MOVABLE);
+        g_handles[h].block = hole;
+        work += moved;
+        moved_any = true;
+
+        // The hole now follows the moved block
+        void *hole_header = (char *)hole + moved;
+        create_header(size, hole_header, FREE);
+        hole = (block *)((char *)hole_header + HEADER_SIZE);
+        hole->prev = prev;
+        hole->next = next;
+        if (prev == NULL) {
+            first_free_block = hole;
         } else {
-            return cur_block;
+            prev->next = hole;
         }
+        if (next != NULL) {
+            next->prev = hole;
+        }
+        g_compact_cursor = hole_header;
     }
-    return NULL;
+    return false;
 }
 
 /*  Function: validate_heap
@@ -500,7 +756,7 @@ bool validate_heap() {
     while (!(cur_size == 0 && cur_used)) {
         byte_count += cur_size + ALIGNMENT;
         if (cur_used) {
-            if (*(size_t *)current % ALIGNMENT != 1) {
+            if ((*(size_t *)current & ~(size_t)MOVABLE) % ALIGNMENT != 1) {
                 breakpoint();
                 return false;
             } else {
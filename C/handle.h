@@ -0,0 +1,44 @@
+/* File: handle.h
+ * --------------
+ * Movable allocations for the explicit allocator. A block allocated with
+ * halloc is reached through its handle: hlock returns its current address
+ * and pins it, hunlock allows it to move again. Between requests, hcompact
+ * slides unlocked handle blocks toward the start of the heap so that the
+ * free space between them merges into larger blocks. Plain mymalloc blocks
+ * never move.
+ */
+
+#ifndef _handle_h
+#define _handle_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t handle;  // 0 is never a valid handle
+
+/* Allocates size bytes and returns their handle, or 0 if out of memory.
+ */
+handle halloc(size_t size);
+
+/* Returns the address of the handle's bytes and pins them there until the
+ * matching hunlock. Locks nest. Returns NULL for an invalid handle.
+ */
+void *hlock(handle h);
+
+/* Undoes one hlock. Addresses returned by hlock may be stale afterwards.
+ */
+void hunlock(handle h);
+
+/* Frees the handle and its bytes, locked or not.
+ */
+void hfree(handle h);
+
+/* Runs one compaction step of about budget bytes of work (bytes moved plus
+ * headers visited); the next step resumes where this one stopped. A block
+ * larger than the budget is moved by a step of its own. Returns true when
+ * the step reached the end of the heap, i.e. a full pass is done.
+ */
+bool hcompact(size_t budget);
+
+#endif
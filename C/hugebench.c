@@ -0,0 +1,79 @@
+/*  Benchmark for huge page backing of the heap segment (see segment.c).
+ *  Fills a segment of the given size with one random cycle of pointers,
+ *  one per 64-byte line, and times a chase around it. Nearly every step
+ *  touches a different page, so the time per step is dominated by TLB
+ *  misses with 4 KB pages. Run it once per HEAP_HUGEPAGES mode to compare.
+ *
+ *  Build:  gcc -std=gnu99 -O2 -o hugebench hugebench.c segment.c
+ *  Usage:  HEAP_HUGEPAGES=off|hot|all|hugetlb ./hugebench [MEGABYTES] [STEPS]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "segment.h"
+
+#define DEFAULT_MEGABYTES 1024
+#define DEFAULT_STEPS (20 * 1000 * 1000L)
+#define LINE_SIZE 64
+
+/*  Function returns the next value of a xorshift64 generator
+ */
+uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    size_t megabytes = (argc > 1 && atol(argv[1]) > 0) ? (size_t)atol(argv[1]) : DEFAULT_MEGABYTES;
+    long steps = (argc > 2 && atol(argv[2]) > 0) ? atol(argv[2]) : DEFAULT_STEPS;
+    size_t size = megabytes * 1024 * 1024;
+    size_t nlines = size / LINE_SIZE;
+
+    char *heap = init_heap_segment(size);
+    size_t *order = malloc(nlines * sizeof(size_t));
+    if (order == NULL) {
+        perror("hugebench");
+        return 1;
+    }
+
+    // Link the lines into one cycle in a random order (Fisher-Yates shuffle)
+    uint64_t state = 88172645463325252ULL;
+    for (size_t i = 0; i < nlines; i++) {
+        order[i] = i;
+    }
+    for (size_t i = nlines - 1; i > 0; i--) {
+        size_t j = next_random(&state) % (i + 1);
+        size_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    double setup_start = now_seconds();
+    for (size_t i = 0; i < nlines; i++) {
+        void **line = (void **)(heap + order[i] * LINE_SIZE);
+        *line = heap + order[(i + 1) % nlines] * LINE_SIZE;
+    }
+    double setup_time = now_seconds() - setup_start;
+    free(order);
+
+    double start = now_seconds();
+    void **p = (void **)heap;
+    for (long i = 0; i < steps; i++) {
+        p = *p;
+    }
+    double elapsed = now_seconds() - start;
+
+    // Printing where the chase ended keeps the compiler from dropping it
+    printf("%zu MB, %ld steps: %.1f ns/step (fill %.2f s, ended at line %zu)\n", megabytes, steps,
+           elapsed * 1e9 / steps, setup_time, (size_t)((char *)p - heap) / LINE_SIZE);
+    return 0;
+}
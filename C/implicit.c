@@ -6,9 +6,16 @@
 
 /* IMPLICIT LIST ALLOCATOR
  * -----------------------
- *
+ * Blocks are found by walking the headers in address order (first fit). To
+ * avoid walking long fully allocated stretches, the heap is divided into
+ * REGION_SIZE-byte regions, and a summary kept at the end of the heap
+ * records, per region, the largest free block whose header lies in it and
+ * where the first such header is. mymalloc skips regions whose largest free
+ * block is too small. The headers stay the source of truth: the summary is
+ * updated on every malloc and free, by rescanning just the affected region.
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "./allocator.h"
@@ -21,6 +28,8 @@
 #define HEADER_SIZE 8
 #define FREE 0
 #define USED 1
+#define REGION_SIZE 4096  // power of two
+#define NO_HEADER UINT32_MAX  // region lies entirely inside one block
 
 // Initialize global variables
 static void *g_heap_start;
@@ -28,6 +37,11 @@ static void *g_heap_end;
 static size_t g_heap_size;
 size_t bytes_used;
 
+// Free-space summary, per region (see top of file)
+static size_t *g_region_max;  // size of the largest free block starting in it
+static uint32_t *g_region_first;  // offset in it of its first header, or NO_HEADER
+static size_t g_nregions;
+
 
 /*  Function: is_used
  *  -----------------
@@ -73,6 +87,34 @@ void toggle_free(void *block) {
     *((size_t *)block) <<= 1;
 }
 
+/*  Function: region_of
+ *  -------------------
+ *  Helper function that returns the region holding a given header.
+ */
+size_t region_of(void *header) {
+    return ((char *)header - (char *)g_heap_start) / REGION_SIZE;
+}
+
+/*  Function: summarize_region
+ *  --------------------------
+ *  Helper function that recomputes the largest free block starting in region r,
+ *  by walking the headers that lie in it.
+ */
+void summarize_region(size_t r) {
+    size_t largest = 0;
+    if (g_region_first[r] != NO_HEADER) {
+        char *region_end = (char *)g_heap_start + (r + 1) * REGION_SIZE;
+        char *current = (char *)g_heap_start + r * REGION_SIZE + g_region_first[r];
+        while (current < region_end && !(header_num(current) == 0 && is_used(current))) {
+            if (!is_used(current) && header_num(current) > largest) {
+                largest = header_num(current);
+            }
+            current += header_num(current) + ALIGNMENT;
+        }
+    }
+    g_region_max[r] = largest;
+}
+
 /*  Function: myinit
  *  ----------------
  *  Function initializes the heap and returns true if this initialization was
@@ -85,6 +127,19 @@ bool myinit(void *heap_start, size_t heap_size) {
         breakpoint();
         return false;
     }
+    // Carve the summary from the end of the heap (one entry per region, sized
+    // for the whole segment, which slightly overestimates what is needed)
+    size_t nregions = (heap_size + REGION_SIZE - 1) / REGION_SIZE;
+    size_t summary_size = roundup(nregions * (sizeof(size_t) + sizeof(uint32_t)), ALIGNMENT);
+    if (heap_size <= MIN_HEAP_SIZE + summary_size) {
+        breakpoint();
+        return false;
+    }
+    heap_size -= summary_size;
+    g_nregions = (heap_size + REGION_SIZE - 1) / REGION_SIZE;
+    g_region_max = (size_t *)((char *)heap_start + heap_size);
+    g_region_first = (uint32_t *)(g_region_max + g_nregions);
+
     // Set up heap
     g_heap_start = heap_start;
     g_heap_size = heap_size;
@@ -99,13 +154,22 @@ bool myinit(void *heap_start, size_t heap_size) {
     void *end_header = (void *)((char *)heap_start + heap_size - HEADER_SIZE);
     create_header(0, end_header, USED);
 
+    // One free block, starting in region 0 and covering all others
+    for (size_t r = 0; r < g_nregions; r++) {
+        g_region_max[r] = 0;
+        g_region_first[r] = NO_HEADER;
+    }
+    g_region_first[0] = 0;
+    g_region_max[0] = header_num(start_header);
+
     return true;
 }
 
 /*  Function: mymalloc
  *  ------------------
  *  Calls helper function roundup to ensure alignment is respected. Function 
- *  traverses heap until an adequate block (right size and free) is found and is returned.
+ *  traverses heap until an adequate block (right size and free) is found and is returned,
+ *  walking only the regions whose summary shows a large enough free block.
  *  If no such block is found, function returns NULL.
  */
 void *mymalloc(size_t requested_size) {
@@ -115,32 +179,49 @@ void *mymalloc(size_t requested_size) {
     // Compute total required size and round up
    size_t size_reqd = roundup(requested_size, ALIGNMENT);
     
-    // Get first block's header, size, and status
-    void *current = g_heap_start;
-    size_t cur_size = header_num(current);
-    bool cur_used = is_used(current);
+    for (size_t r = 0; r < g_nregions; r++) {
+        // Skip regions where no block fits
+        if (g_region_max[r] < size_reqd) {
+            continue;
+        }
+        // Get region's first block's header, size, and status
+        char *region_end = (char *)g_heap_start + (r + 1) * REGION_SIZE;
+        void *current = (char *)g_heap_start + r * REGION_SIZE + g_region_first[r];
+        size_t cur_size = header_num(current);
+        bool cur_used = is_used(current);
 
-    // Traverse heap block by block until required size is found
-    // Loop stops when block size is 0 and block is used (ie end of heap)
-    while (!(cur_size == 0 && cur_used)) {
-        // If block is adequate (enough space and not used)
-        if (!cur_used && (cur_size >= size_reqd)) {
-            // Update current block header
-            create_header(size_reqd, current, USED);
-            
-            // Create block header if more space available than requested
-            if (cur_size > size_reqd) {
-                void *next_header = (void *)((char *)current + size_reqd + ALIGNMENT);
-                create_header(cur_size - size_reqd - ALIGNMENT, next_header, FREE);
+        // Traverse region block by block until required size is found
+        // Loop stops at the end of the region or at the end of heap
+        while ((char *)current < region_end && !(cur_size == 0 && cur_used)) {
+            // If block is adequate (enough space and not used)
+            if (!cur_used && (cur_size >= size_reqd)) {
+                // Update current block header
+                create_header(size_reqd, current, USED);
+
+                // Create block header if more space available than requested
+                if (cur_size > size_reqd) {
+                    void *next_header = (void *)((char *)current + size_reqd + ALIGNMENT);
+                    create_header(cur_size - size_reqd - ALIGNMENT, next_header, FREE);
+
+                    // A header in a later region is that region's first: the block
+                    // covered everything before it there
+                    size_t next_r = region_of(next_header);
+                    if (next_r != r) {
+                        g_region_first[next_r] = (char *)next_header - ((char *)g_heap_start + next_r * REGION_SIZE);
+                        summarize_region(next_r);
+                    }
+                }
+                summarize_region(r);
+
+                // Return pointer to allocated memory
+                void *mem_ptr = (void *)((char *)current + ALIGNMENT);
+                return mem_ptr;
             }
-            // Return pointer to allocated memory
-            void *mem_ptr = (void *)((char *)current + ALIGNMENT);
-            return mem_ptr;
+            // Move to next block
+            current = (void *)(((char *)current) + cur_size + ALIGNMENT);
+            cur_used = is_used(current);
+            cur_size = header_num(current);
         }
-        // Move to next block
-        current = (void *)(((char *)current) + cur_size + ALIGNMENT);
-        cur_used = is_used(current);
-        cur_size = header_num(current);
     }
     // Adequate block not found
     return NULL;
@@ -157,6 +238,12 @@ void myfree(void *ptr) {
     }
     size_t *new_ptr = (size_t *)((char *)ptr - ALIGNMENT);
     toggle_free(new_ptr);
+
+    // The freed block may now be the largest of its region
+    size_t r = region_of(new_ptr);
+    if (header_num(new_ptr) > g_region_max[r]) {
+        g_region_max[r] = header_num(new_ptr);
+    }
 }
 
 /*  Function: myrealloc
@@ -196,9 +283,31 @@ bool validate_heap() {
     // Header byte counter
     size_t byte_count = ALIGNMENT;
 
+    // Region of the previous header, to check each region's first header
+    size_t prev_r = 0;
+    if (g_region_first[0] != 0) {
+        breakpoint();
+        return false;
+    }
+
     // Traverse heap while size!=0 and not free
     while (!(cur_size == 0 && cur_used)) {
         byte_count += cur_size + ALIGNMENT;        
+        size_t r = region_of(current);
+        if (r != prev_r) {
+            // Regions skipped over must hold no header
+            for (size_t skipped = prev_r + 1; skipped < r; skipped++) {
+                if (g_region_first[skipped] != NO_HEADER) {
+                    breakpoint();
+                    return false;
+                }
+            }
+            if (g_region_first[r] != (size_t)((char *)current - ((char *)g_heap_start + r * REGION_SIZE))) {
+                breakpoint();
+                return false;
+            }
+            prev_r = r;
+        }
         if (cur_used) {
             if (*(size_t *)current % ALIGNMENT != 1) {
                 breakpoint();
@@ -220,6 +329,15 @@ bool validate_heap() {
         breakpoint();
         return false;
     }
+    // Validate the free-space summary against the headers
+    for (size_t r = 0; r < g_nregions; r++) {
+        size_t recorded = g_region_max[r];
+        summarize_region(r);
+        if (g_region_max[r] != recorded) {
+            breakpoint();
+            return false;
+        }
+    }
     return true;
 }
 
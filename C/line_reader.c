@@ -0,0 +1,109 @@
+/* File: line_reader.c
+ * -------------------
+ * Implements the line reader declared in line_reader.h. Input is kept in
+ * one buffer: bytes [start, end) have been read but not yet returned, and
+ * bytes [start, scanned) are known to contain no newline, so a long line
+ * that needs several refills is only scanned once.
+ */
+
+#include "line_reader.h"
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INITIAL_BUFFER_SIZE (256 * 1024)
+#define MIN_READ_SIZE (64 * 1024)  // free space wanted before each read
+
+struct line_reader {
+    int fd;
+    char *buf;
+    size_t cap;
+    size_t start;
+    size_t scanned;
+    size_t end;
+    bool eof;
+};
+
+line_reader *line_reader_open(int fd) {
+    line_reader *reader = malloc(sizeof(line_reader));
+    if (reader == NULL) {
+        return NULL;
+    }
+    reader->buf = malloc(INITIAL_BUFFER_SIZE);
+    if (reader->buf == NULL) {
+        free(reader);
+        return NULL;
+    }
+    reader->fd = fd;
+    reader->cap = INITIAL_BUFFER_SIZE;
+    reader->start = reader->scanned = reader->end = 0;
+    reader->eof = false;
+    return reader;
+}
+
+/* Function reads more input after the buffered bytes. The partial line is
+ * first moved to the front of the buffer, and the buffer doubles if it is
+ * still too full to take a large read. Sets eof when input is exhausted.
+ */
+static void refill(line_reader *reader) {
+    if (reader->start > 0) {
+        size_t pending = reader->end - reader->start;
+        memmove(reader->buf, reader->buf + reader->start, pending);
+        reader->scanned -= reader->start;
+        reader->end = pending;
+        reader->start = 0;
+    }
+    if (reader->cap - reader->end < MIN_READ_SIZE) {
+        char *grown = realloc(reader->buf, reader->cap * 2);
+        if (grown == NULL) {
+            error(1, errno, "out of memory");
+        }
+        reader->buf = grown;
+        reader->cap *= 2;
+    }
+    while (true) {
+        ssize_t nread = read(reader->fd, reader->buf + reader->end, reader->cap - reader->end);
+        if (nread == -1 && errno == EINTR) {
+            continue;
+        }
+        if (nread == -1) {
+            error(1, errno, "read error");
+        }
+        if (nread == 0) {
+            reader->eof = true;
+        }
+        reader->end += nread;
+        return;
+    }
+}
+
+bool line_reader_next(line_reader *reader, line_view *view) {
+    while (true) {
+        char *newline = memchr(reader->buf + reader->scanned, '\n', reader->end - reader->scanned);
+        if (newline != NULL) {
+            view->ptr = reader->buf + reader->start;
+            view->len = newline - view->ptr;
+            reader->start = reader->scanned = newline + 1 - reader->buf;
+            return true;
+        }
+        reader->scanned = reader->end;
+        if (reader->eof) {
+            if (reader->start == reader->end) {
+                return false;
+            }
+            // Last line has no newline
+            view->ptr = reader->buf + reader->start;
+            view->len = reader->end - reader->start;
+            reader->start = reader->scanned = reader->end;
+            return true;
+        }
+        refill(reader);
+    }
+}
+
+void line_reader_close(line_reader *reader) {
+    free(reader->buf);
+    free(reader);
+}
@@ -0,0 +1,38 @@
+/* File: line_reader.h
+ * -------------------
+ * Streaming line reader that hands out lines without allocating them.
+ * Each line is returned as a view (pointer and length, without the '\n')
+ * into the reader's internal buffer. The buffer is refilled with large
+ * reads, and it grows when a single line does not fit, so lines of any
+ * length are supported.
+ */
+
+#ifndef _line_reader_h
+#define _line_reader_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct line_view {
+    const char *ptr;
+    size_t len;
+} line_view;
+
+typedef struct line_reader line_reader;
+
+/* Creates a reader over the open file descriptor fd (use fileno() for a
+ * FILE * that has not been read from yet). Returns NULL if out of memory.
+ */
+line_reader *line_reader_open(int fd);
+
+/* Stores the next line in *view and returns true, or returns false at end
+ * of input. A last line without a trailing newline is still returned. The
+ * view is only valid until the next call. Exits on read errors.
+ */
+bool line_reader_next(line_reader *reader, line_view *view);
+
+/* Frees the reader. The file descriptor is left open.
+ */
+void line_reader_close(line_reader *reader);
+
+#endif
@@ -1,67 +1,396 @@
 /*  Own version of tail command in C.
+ *  Regular files are read backward from the end in fixed-size blocks, so the
+ *  cost depends on the size of the output and not on the size of the file.
+ *  Other inputs (pipes, terminals) are read forward into a ring buffer that
+ *  only holds the last lines seen.
  */
 
+#define _GNU_SOURCE  // memrchr
 #include <errno.h>
 #include <error.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "samples/prototypes.h"
 
 #define MAX_NUM_LINES 100000
 #define DEFAULT_NUM_LINES 10
 #define NUMERIC_ARG_BASE 10
+#define TAIL_BLOCK_SIZE (64 * 1024)  // bytes read per pread from end of file
+#define RING_INITIAL_SIZE (256 * 1024)  // starting size of the stdin ring buffer
+#define RING_READ_SIZE (64 * 1024)  // free ring space wanted before each read
+#define FOLLOW_RECHECK_MS 1000  // inotify wait before re-checking for rotation
+#define FOLLOW_POLL_MS 100  // sleep between size checks without inotify
 
-/*  Function prints the last n characters in a file (similar to mytail).
- *  It takes pointer to a file and a number of elements to read. If number of 
- *  elements in file is less than number of elements to be read (n), function
- *  prints entire file, line by line, enumerated by line number.
+/*  Function writes len bytes of buf to the file descriptor fd, retrying
+ *  after partial writes and interrupted calls. Exits on write errors.
  */
-void print_last_n(FILE *file_pointer, int n) {
-    char *line = NULL;
-    char *arr[n];  // array size n
-    int index = 0;
-    int counter = 0;  // # lines read
-    int complete = 0;  // flag triggers when array is full of elements
-
-    while ((line = read_line(file_pointer)) != NULL) {
-        // If array is full of elements
-        if (complete == 1) {
-            free(arr[index]);  // free line at index in array
-        } 
-        arr[index] = line;  // add current line to arr
-        index++;
-        counter++;
-        
-        // Array full: reset index and trigger flag
-        if (index == n) {
-            index = 0;
-            complete = 1;  // flag to complete
-         }
-    }
-    // If lines read is less than -n-, print all lines
-    // Note: this is inefficient, as two segments of code are almost equivalent,
-    // but was implemented this way to prevent a late submission and to handle an
-    // "edge case"
-    if (counter < n) {
-        for (int i = 0; i < counter; i++) {
-            // If index at last elem, reset to start of array
-            if (index == counter) {
-                index = 0;
+void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
             }
-            printf("%s\n", arr[index]);
-            free(arr[index]);  // free memory
-            index++;
+            error(1, errno, "write error");
         }
-    // Else, print -n- lines in order
-    } else {
-        for (int i = 0; i < n; i ++) {
-            printf("%s\n", arr[index]);
-            free(arr[index]);  // free memory
-            index++;
-            if (index == n) {
-                index = 0;  // reset index
+        buf += written;
+        len -= written;
+    }
+}
+
+/*  Function reads exactly len bytes at offset from fd into buf (short reads
+ *  only happen if the file shrinks while we read it). Exits on read errors.
+ */
+size_t pread_full(int fd, char *buf, size_t len, off_t offset) {
+    size_t total = 0;
+    while (total < len) {
+        ssize_t nread = pread(fd, buf + total, len - total, offset + total);
+        if (nread == -1) {
+            if (errno == EINTR) {
+                continue;
             }
-        } 
+            error(1, errno, "read error");
+        }
+        if (nread == 0) {
+            break;  // file was truncated under us
+        }
+        total += nread;
+    }
+    return total;
+}
+
+/*  Function prints the last n lines of a seekable file given by fd. Data is
+ *  only read between the file offset "first" (where the input starts) and
+ *  "last" (end of file). Blocks are read backward from "last" and newlines
+ *  are counted with memrchr until the start of the n-th last line is found.
+ *  That final region is then copied to stdout with large writes. Like the
+ *  line-by-line version, a last line without a trailing newline gets one if
+ *  end_line is true (not when following, where it is likely still being
+ *  written and its rest follows).
+ */
+void print_last_n_seekable(int fd, off_t first, off_t last, int n, bool end_line) {
+    if (last <= first) {
+        return;
+    }
+    char *block = malloc(TAIL_BLOCK_SIZE);
+    if (block == NULL) {
+        error(1, errno, "out of memory");
+    }
+
+    off_t pos = last;  // file offset of the start of the unscanned tail
+    off_t start = first;  // file offset where output begins
+    int needed = n;  // newlines left to find before the n-th last line
+    bool ends_in_newline = false;
+
+    while (pos > first && needed > 0) {
+        size_t chunk = (pos - first < TAIL_BLOCK_SIZE) ? pos - first : TAIL_BLOCK_SIZE;
+        pos -= chunk;
+        size_t len = pread_full(fd, block, chunk, pos);
+
+        // The newline ending the last line does not separate lines
+        if (pos + (off_t)chunk == last && len > 0 && block[len - 1] == '\n') {
+            ends_in_newline = true;
+            len--;
+        }
+        // Walk backward through the block one newline at a time
+        char *newline = NULL;
+        while (needed > 0 && (newline = memrchr(block, '\n', len)) != NULL) {
+            len = newline - block;
+            needed--;
+        }
+        if (needed == 0) {
+            start = pos + len + 1;  // first byte after the newline found
+        }
+    }
+
+    // Copy the region holding the last n lines to stdout
+    fflush(stdout);
+    for (off_t offset = start; offset < last; ) {
+        size_t chunk = (last - offset < TAIL_BLOCK_SIZE) ? last - offset : TAIL_BLOCK_SIZE;
+        size_t len = pread_full(fd, block, chunk, offset);
+        if (len == 0) {
+            break;
+        }
+        write_all(STDOUT_FILENO, block, len);
+        offset += len;
+    }
+    if (end_line && !ends_in_newline) {
+        write_all(STDOUT_FILENO, "\n", 1);
+    }
+    free(block);
+}
+
+/*  Function returns the stream offset where the last n lines begin, given
+ *  the offsets of the most recent newlines (newlines[] is a ring of n + 1
+ *  slots, next is the slot written next, count how many are filled) and
+ *  whether the stream so far ends with a newline. If the stream ended now,
+ *  everything before this offset would not be printed, and reading more
+ *  input only moves it forward, so those bytes can be discarded.
+ */
+uint64_t window_start(const uint64_t newlines[], size_t next, size_t count, int n, bool ends_in_newline) {
+    // A finished last line needs n + 1 newlines back, a partial one n
+    size_t back = ends_in_newline ? n + 1 : n;
+    if (count < back) {
+        return 0;
+    }
+    size_t slot = (next + (n + 1) - back) % (n + 1);
+    return newlines[slot] + 1;
+}
+
+/*  Function copies the ring buffer bytes at stream offsets [first, last)
+ *  either to the file descriptor fd (when dst is NULL) or into the ring
+ *  dst of size dst_cap. Both ring sizes are powers of two.
+ */
+void ring_copy(const char *ring, size_t cap, uint64_t first, uint64_t last, int fd, char *dst, size_t dst_cap) {
+    while (first < last) {
+        size_t pos = first & (cap - 1);
+        size_t len = (last - first < cap - pos) ? last - first : cap - pos;
+        if (dst == NULL) {
+            write_all(fd, ring + pos, len);
+        } else {
+            size_t dst_pos = first & (dst_cap - 1);
+            if (len > dst_cap - dst_pos) {
+                len = dst_cap - dst_pos;
+            }
+            memcpy(dst + dst_pos, ring + pos, len);
+        }
+        first += len;
+    }
+}
+
+/*  Function prints the last n lines of an input that can only be read
+ *  forward, such as a pipe. Raw input is read in large chunks into a byte
+ *  ring buffer, and the stream offsets of the last n + 1 newlines are kept
+ *  in a second ring. Bytes before the start of the last n lines are
+ *  overwritten in place, so there is no allocation per line and the buffer
+ *  only grows when the last n lines themselves do not fit. A last line
+ *  without a newline gets one if end_line is true.
+ */
+void print_last_n_stream(int fd, int n, bool end_line) {
+    size_t cap = RING_INITIAL_SIZE;  // always a power of two
+    char *ring = malloc(cap);
+    uint64_t *newlines = malloc((n + 1) * sizeof(uint64_t));
+    if (ring == NULL || newlines == NULL) {
+        error(1, errno, "out of memory");
+    }
+    size_t next = 0;  // newline slot written next
+    size_t count = 0;  // newline slots filled, capped at n + 1 after each read
+    uint64_t total = 0;  // bytes read so far
+    uint64_t keep = 0;  // oldest stream offset still held in the ring
+
+    while (true) {
+        // Make room for the next read, discarding lines that scrolled off
+        if (cap - (total - keep) < RING_READ_SIZE) {
+            bool ends_in_newline = total == 0 || ring[(total - 1) & (cap - 1)] == '\n';
+            keep = window_start(newlines, next, count, n, ends_in_newline);
+        }
+        if (cap - (total - keep) < RING_READ_SIZE) {
+            size_t new_cap = cap;
+            while (new_cap - (total - keep) < RING_READ_SIZE) {
+                new_cap *= 2;
+            }
+            char *grown = malloc(new_cap);
+            if (grown == NULL) {
+                error(1, errno, "out of memory");
+            }
+            ring_copy(ring, cap, keep, total, -1, grown, new_cap);
+            free(ring);
+            ring = grown;
+            cap = new_cap;
+        }
+
+        // Read straight into the free part of the ring (up to its end)
+        size_t pos = total & (cap - 1);
+        size_t space = cap - (total - keep);
+        size_t len = (space < cap - pos) ? space : cap - pos;
+        ssize_t nread = read(fd, ring + pos, len);
+        if (nread == 0) {
+            break;
+        }
+        if (nread == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error(1, errno, "read error");
+        }
+
+        // Record where the newlines in the new bytes are
+        const char *scan = ring + pos;
+        const char *end = ring + pos + nread;
+        const char *newline = NULL;
+        while ((newline = memchr(scan, '\n', end - scan)) != NULL) {
+            newlines[next] = total + (newline - (ring + pos));
+            if (++next == (size_t)n + 1) {
+                next = 0;  // wrap without a division per line
+            }
+            scan = newline + 1;
+            count++;
+        }
+        total += nread;
+        if (count > (size_t)n + 1) {
+            count = n + 1;
+        }
+    }
+
+    bool ends_in_newline = total == 0 || ring[(total - 1) & (cap - 1)] == '\n';
+    uint64_t start = window_start(newlines, next, count, n, ends_in_newline);
+    fflush(stdout);
+    ring_copy(ring, cap, start, total, STDOUT_FILENO, NULL, 0);
+    if (end_line && !ends_in_newline) {
+        write_all(STDOUT_FILENO, "\n", 1);
+    }
+    free(newlines);
+    free(ring);
+}
+
+/*  Function prints the last n lines in a file. Regular files are tailed
+ *  from the end with print_last_n_seekable, anything else is streamed.
+ *  end_line is false in follow mode, where an unfinished last line is
+ *  printed as it is so that its rest continues it.
+ */
+void print_last_n(FILE *file_pointer, int n, bool end_line) {
+    int fd = fileno(file_pointer);
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        // Input may not start at offset 0 (e.g. a shared, redirected stdin)
+        off_t first = lseek(fd, 0, SEEK_CUR);
+        if (first != -1) {
+            print_last_n_seekable(fd, first, st.st_size, n, end_line);
+            lseek(fd, st.st_size, SEEK_SET);  // follow mode resumes here
+            return;
+        }
+    }
+    print_last_n_stream(fd, n, end_line);
+}
+
+/*  Function copies everything appended to fd since *p_offset to stdout and
+ *  advances *p_offset. If the file shrank below *p_offset it was truncated,
+ *  so copying restarts from the beginning. Data is moved with sendfile where
+ *  the kernel supports it for stdout, and with large pread/write otherwise.
+ */
+void copy_appended(int fd, off_t *p_offset, const char *name) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        error(1, errno, "cannot access '%s'", name);
+    }
+    if (st.st_size < *p_offset) {
+        error(0, 0, "%s: file truncated", name);
+        *p_offset = 0;
+    }
+    off_t last = st.st_size;
+    while (*p_offset < last) {
+        ssize_t sent = sendfile(STDOUT_FILENO, fd, p_offset, last - *p_offset);
+        if (sent > 0) {
+            continue;  // sendfile advanced *p_offset
+        }
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent == 0) {
+            return;  // truncated while copying, caught on the next call
+        }
+        if (errno != EINVAL && errno != ENOSYS) {
+            error(1, errno, "write error");
+        }
+        // stdout does not accept sendfile, copy through a buffer instead
+        char block[TAIL_BLOCK_SIZE];
+        while (*p_offset < last) {
+            size_t chunk = (last - *p_offset < TAIL_BLOCK_SIZE) ? last - *p_offset : TAIL_BLOCK_SIZE;
+            size_t len = pread_full(fd, block, chunk, *p_offset);
+            if (len == 0) {
+                return;
+            }
+            write_all(STDOUT_FILENO, block, len);
+            *p_offset += len;
+        }
+    }
+}
+
+/*  Function checks whether path now names a different file than fd (the
+ *  log was rotated by rename or delete-and-recreate). If so, it drains
+ *  what is left of the old file, switches *p_fd to the new one from offset
+ *  0 and returns true. Returns false if nothing changed or the new file
+ *  does not exist yet.
+ */
+bool reopen_if_rotated(const char *path, int *p_fd, off_t *p_offset) {
+    struct stat path_st, fd_st;
+    if (stat(path, &path_st) == -1 || fstat(*p_fd, &fd_st) == -1) {
+        return false;
+    }
+    if (path_st.st_ino == fd_st.st_ino && path_st.st_dev == fd_st.st_dev) {
+        return false;
+    }
+    int new_fd = open(path, O_RDONLY);
+    if (new_fd == -1) {
+        return false;
+    }
+    copy_appended(*p_fd, p_offset, path);
+    close(*p_fd);
+    error(0, 0, "'%s' has been replaced; following new file", path);
+    *p_fd = new_fd;
+    *p_offset = 0;
+    return true;
+}
+
+/*  Function adds inotify watches for the followed file and for its parent
+ *  directory (to notice a rotated log being recreated). Returns the watch
+ *  descriptor of the file, or -1 if it cannot be watched.
+ */
+int watch_file(int inotify_fd, const char *path) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    inotify_add_watch(inotify_fd, dirname(dir), IN_CREATE | IN_MOVED_TO);
+    return inotify_add_watch(inotify_fd, path, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+}
+
+/*  Function implements follow mode (-f): after the last lines have been
+ *  printed, it keeps copying data appended to the file to stdout. It
+ *  blocks on inotify events so an idle log costs no CPU, and re-checks
+ *  for truncation and rotation on every wakeup. Without inotify (or when
+ *  following stdin, which has no path) it falls back to polling the size.
+ *  Never returns.
+ */
+void follow(int fd, const char *path) {
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset == -1) {
+        offset = 0;
+    }
+    const char *name = (path != NULL) ? path : "standard input";
+    int inotify_fd = (path != NULL) ? inotify_init1(IN_NONBLOCK | IN_CLOEXEC) : -1;
+    int wd = (inotify_fd != -1) ? watch_file(inotify_fd, path) : -1;
+    // inotify events are only wakeups, their contents are not needed
+    char events[sizeof(struct inotify_event) + NAME_MAX + 1] __attribute__((aligned(8)));
+
+    while (true) {
+        copy_appended(fd, &offset, name);
+        if (path != NULL && reopen_if_rotated(path, &fd, &offset)) {
+            if (wd != -1) {
+                inotify_rm_watch(inotify_fd, wd);
+                wd = watch_file(inotify_fd, path);
+            }
+            continue;
+        }
+
+        if (wd != -1) {
+            struct pollfd pfd = { .fd = inotify_fd, .events = POLLIN };
+            if (poll(&pfd, 1, FOLLOW_RECHECK_MS) > 0) {
+                // drain every queued event, one copy pass covers them all
+                while (read(inotify_fd, events, sizeof(events)) > 0) {}
+            }
+        } else {
+            poll(NULL, 0, FOLLOW_POLL_MS);
+        }
     }
 }
 
@@ -83,9 +412,15 @@ int convert_arg(const char *str, int max) {
 // handle arguments and open file
 int main(int argc, char *argv[]) {
     int num_lines = DEFAULT_NUM_LINES;
+    bool follow_mode = false;
 
-    if (argc > 1 && argv[1][0] == '-') {
-        num_lines = convert_arg(argv[1] + 1, MAX_NUM_LINES);
+    // options: -N prints the last N lines, -f then keeps printing what is appended
+    while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+        if (strcmp(argv[1], "-f") == 0) {
+            follow_mode = true;
+        } else {
+            num_lines = convert_arg(argv[1] + 1, MAX_NUM_LINES);
+        }
         argv++;
         argc--;
     }
@@ -100,7 +435,15 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    print_last_n(file_pointer, num_lines);
+    print_last_n(file_pointer, num_lines, !follow_mode);
+    if (follow_mode) {
+        // following only makes sense for files that can grow in place
+        struct stat st;
+        fflush(stdout);
+        if (fstat(fileno(file_pointer), &st) == 0 && S_ISREG(st.st_mode)) {
+            follow(fileno(file_pointer), (argc == 1) ? NULL : argv[1]);
+        }
+    }
     fclose(file_pointer);
     return 0;
 }
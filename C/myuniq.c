@@ -1,89 +1,602 @@
 /*  This file implements a similar version of unic in C.
  *  The major advantage of this function is that it filters out all duplicates.
+ *  Lines are counted in a hash table, so each input line costs O(1) on
+ *  average no matter how many distinct lines have been seen.
+ *  With --threads=N a regular file is mapped into memory, split into N
+ *  shards at line boundaries and counted by N threads; the per-shard tables
+ *  are merged in file order so the output matches the serial version.
+ *  With --top=K the exact table is replaced by a fixed-size count-min sketch
+ *  and a heap of the K heaviest lines, for streams with too many distinct
+ *  lines to count exactly (--memory=BYTES sets the sketch size).
  */
 #include <errno.h>
 #include <error.h>
 #include <stdio.h>
 #include "samples/prototypes.h"
+#include "line_reader.h"
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-/* initial estimate of number of uniq lines
- * resize-as-you-go, add in increments of 100
+/* initial number of hash table slots (always a power of two) and of
+ * entries; both double as they fill up
  */
-#define ESTIMATE 100
+#define INITIAL_SLOTS 1024
+#define INITIAL_ENTRIES 512
+// lines are copied into arena blocks of this size (longer lines get their own)
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+#define MAX_THREADS 256
+// approximate (--top) mode: sketch rows, default and largest sketch size in
+// bytes (--memory), and largest number of heavy hitters tracked
+#define SKETCH_DEPTH 4
+#define DEFAULT_SKETCH_BUDGET (4 * 1024 * 1024)
+#define MAX_SKETCH_BUDGET (1L << 34)
+#define MAX_TOP_K (1 << 20)
+#define NUMERIC_ARG_BASE 10
 
 // Define a struct to store information about a line in the file read
-// struct stores the string itself and a count of how many times the 
-// string appears in the file.
+// struct stores the string itself, its length and hash, and a count of how
+// many times the string appears in the file.
 typedef struct entry {
     char *string;
+    size_t len;
+    uint64_t hash;
     int count; 
 } entry;
 
+// Arena of large blocks that stores the text of every unique line, so
+// keys need no allocation of their own. Each block starts with a pointer
+// to the previous block so the whole chain can be freed at the end.
+typedef struct arena {
+    char *block;
+    size_t used;
+    size_t size;
+} arena;
 
-// Function prints the number of times n lines occur in a file
-void print_uniq_lines(FILE *file_pointer) {
-    // Initialize line and array (malloc'd) of entries
-    char *line = NULL;
-    entry *arr = malloc(ESTIMATE * sizeof(entry));  // array of pointers
-    assert(arr);
-
-    // Initialize variables to keep track of process
-    int arrSize = ESTIMATE;
-    int uniqLineArr = 0;  // number of unique lines in array (ie # of struct elems)
-    int flag = 0;  // flag to check when a line already exists in array
-
-    while((line = read_line(file_pointer)) != NULL) {
-        // Dynamic memory allocation if array is full
-        if (uniqLineArr == arrSize) {
-            arrSize += ESTIMATE;
-            arr = realloc(arr, (arrSize)*sizeof(entry));
-            assert(arr);
+// Counting table: entries are kept in first-seen order, and slots is an
+// open-addressing (linear probing) hash table of indices into entries.
+// A slot holds entry index + 1, so 0 means empty. When copy_keys is false
+// the caller guarantees the line text outlives the table (e.g. a mapped
+// file) and entries point at it directly instead of into the arena.
+typedef struct count_table {
+    entry *entries;
+    size_t nentries;
+    size_t entries_cap;
+    uint32_t *slots;
+    size_t nslots;
+    arena keys;
+    bool copy_keys;
+} count_table;
+
+// Work for one counting thread: a shard [start, end) of the mapped file,
+// always beginning at the start of a line, and its private table
+typedef struct shard {
+    const char *start;
+    const char *end;
+    count_table table;
+} shard;
+
+// Function hashes a line with 64-bit FNV-1a
+uint64_t hash_line(const char *line, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)line[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Function copies len bytes of line (plus a terminating '\0') into the arena
+char *arena_copy(arena *a, const char *line, size_t len) {
+    size_t needed = len + 1;
+    if (a->block == NULL || a->size - a->used < needed) {
+        size_t size = sizeof(char *) + needed;
+        if (size < ARENA_BLOCK_SIZE) {
+            size = ARENA_BLOCK_SIZE;
         }
-        // If line is in array, increase counter
-        for (int i = 0; i < uniqLineArr; i++) {
-            if (strcmp(line, arr[i].string) == 0) {
-                arr[i].count += 1;
-                free(line);
-                flag = 1;  // trigger flag
-                break;
+        char *block = malloc(size);
+        assert(block);
+        *(char **)block = a->block;  // link to previous block
+        a->block = block;
+        a->used = sizeof(char *);
+        a->size = size;
+    }
+    char *copy = a->block + a->used;
+    memcpy(copy, line, len);
+    copy[len] = '\0';
+    a->used += needed;
+    return copy;
+}
+
+// Function frees every block of the arena
+void arena_free(arena *a) {
+    while (a->block != NULL) {
+        char *prev = *(char **)a->block;
+        free(a->block);
+        a->block = prev;
+    }
+}
+
+// Function initializes an empty counting table
+void table_init(count_table *table, bool copy_keys) {
+    table->entries_cap = INITIAL_ENTRIES;
+    table->entries = malloc(table->entries_cap * sizeof(entry));
+    table->nentries = 0;
+    table->nslots = INITIAL_SLOTS;
+    table->slots = calloc(table->nslots, sizeof(uint32_t));
+    assert(table->entries && table->slots);
+    table->keys.block = NULL;
+    table->copy_keys = copy_keys;
+}
+
+// Function doubles the number of slots and re-inserts every entry using
+// its stored hash, so no line is hashed twice
+void table_grow_slots(count_table *table) {
+    size_t nslots = table->nslots * 2;
+    uint32_t *slots = calloc(nslots, sizeof(uint32_t));
+    assert(slots);
+    for (size_t i = 0; i < table->nentries; i++) {
+        size_t slot = table->entries[i].hash & (nslots - 1);
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (nslots - 1);
+        }
+        slots[slot] = i + 1;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->nslots = nslots;
+}
+
+// Function adds count occurrences of line (with precomputed hash) to the
+// table, creating a new entry at the end if the line was not seen before
+void table_add(count_table *table, const char *line, size_t len, uint64_t hash, int count) {
+    size_t slot = hash & (table->nslots - 1);
+    while (table->slots[slot] != 0) {
+        entry *cur = &table->entries[table->slots[slot] - 1];
+        if (cur->hash == hash && cur->len == len && memcmp(cur->string, line, len) == 0) {
+            cur->count += count;
+            return;
+        }
+        slot = (slot + 1) & (table->nslots - 1);
+    }
+
+    // New line: append entry, then keep load factor at or below 1/2
+    if (table->nentries == table->entries_cap) {
+        table->entries_cap *= 2;
+        table->entries = realloc(table->entries, table->entries_cap * sizeof(entry));
+        assert(table->entries);
+    }
+    entry *new_entry = &table->entries[table->nentries];
+    new_entry->string = table->copy_keys ? arena_copy(&table->keys, line, len) : (char *)line;
+    new_entry->len = len;
+    new_entry->hash = hash;
+    new_entry->count = count;
+    table->slots[slot] = ++table->nentries;
+    if (table->nentries * 2 > table->nslots) {
+        table_grow_slots(table);
+    }
+}
+
+// Function frees all memory owned by the table
+void table_free(count_table *table) {
+    arena_free(&table->keys);
+    free(table->entries);
+    free(table->slots);
+}
+
+// Count-min sketch: depth rows of width counters (width a power of two).
+// Row i uses the hash h1 + i * h2 derived from the 64-bit line hash.
+typedef struct sketch {
+    uint32_t *counters;
+    size_t width;
+} sketch;
+
+// A heavy-hitter candidate: a copy of the line, its hash and its current
+// sketch estimate, plus the index slot that points back at it
+typedef struct candidate {
+    char *string;
+    size_t len;
+    uint64_t hash;
+    uint64_t estimate;
+    size_t slot;
+} candidate;
+
+// Min-heap (by estimate) of at most k candidates. slots is a linear-probing
+// index from line hash to heap position + 1 (0 means empty), kept at most
+// half full and updated whenever candidates move in the heap.
+typedef struct top_heap {
+    candidate *heap;
+    size_t size;
+    size_t k;
+    uint32_t *slots;
+    size_t nslots;
+} top_heap;
+
+// Function sizes the sketch to the memory budget, rounding the width down
+// to a power of two
+void sketch_init(sketch *cms, size_t budget) {
+    size_t width = 1;
+    while (width * 2 * SKETCH_DEPTH * sizeof(uint32_t) <= budget) {
+        width *= 2;
+    }
+    cms->width = width;
+    cms->counters = calloc(width * SKETCH_DEPTH, sizeof(uint32_t));
+    assert(cms->counters);
+}
+
+// Function counts one occurrence of the line with the given hash and
+// returns its new estimate. Uses conservative update: only the counters
+// at the current minimum are raised, which keeps the estimate an upper
+// bound while adding less noise to other lines.
+uint64_t sketch_add(sketch *cms, uint64_t hash) {
+    uint32_t h1 = hash;
+    uint32_t h2 = (hash >> 32) | 1;
+    uint32_t *cells[SKETCH_DEPTH];
+    uint32_t min = UINT32_MAX;
+    for (int i = 0; i < SKETCH_DEPTH; i++) {
+        cells[i] = &cms->counters[i * cms->width + ((h1 + i * h2) & (cms->width - 1))];
+        if (*cells[i] < min) {
+            min = *cells[i];
+        }
+    }
+    if (min == UINT32_MAX) {
+        return min;  // saturated
+    }
+    for (int i = 0; i < SKETCH_DEPTH; i++) {
+        if (*cells[i] == min) {
+            *cells[i] = min + 1;
+        }
+    }
+    return min + 1;
+}
+
+// Function initializes an empty heap for k candidates
+void top_init(top_heap *top, size_t k) {
+    top->heap = malloc(k * sizeof(candidate));
+    top->size = 0;
+    top->k = k;
+    top->nslots = 4;
+    while (top->nslots < 2 * k) {
+        top->nslots *= 2;
+    }
+    top->slots = calloc(top->nslots, sizeof(uint32_t));
+    assert(top->heap && top->slots);
+}
+
+// Function places candidate cur at heap position pos and points its index
+// slot there
+void top_place(top_heap *top, size_t pos, candidate cur) {
+    top->heap[pos] = cur;
+    top->slots[cur.slot] = pos + 1;
+}
+
+// Function moves the candidate at pos down the heap until both children
+// have larger estimates
+void top_sift_down(top_heap *top, size_t pos) {
+    candidate cur = top->heap[pos];
+    while (2 * pos + 1 < top->size) {
+        size_t child = 2 * pos + 1;
+        if (child + 1 < top->size && top->heap[child + 1].estimate < top->heap[child].estimate) {
+            child++;
+        }
+        if (top->heap[child].estimate >= cur.estimate) {
+            break;
+        }
+        top_place(top, pos, top->heap[child]);
+        pos = child;
+    }
+    top_place(top, pos, cur);
+}
+
+// Function moves the candidate at pos up the heap until its parent has a
+// smaller estimate
+void top_sift_up(top_heap *top, size_t pos) {
+    candidate cur = top->heap[pos];
+    while (pos > 0 && top->heap[(pos - 1) / 2].estimate > cur.estimate) {
+        top_place(top, pos, top->heap[(pos - 1) / 2]);
+        pos = (pos - 1) / 2;
+    }
+    top_place(top, pos, cur);
+}
+
+// Function empties index slot i with backward-shift deletion, moving later
+// entries of the probe run into the hole so lookups need no tombstones
+void top_unindex(top_heap *top, size_t i) {
+    size_t mask = top->nslots - 1;
+    top->slots[i] = 0;
+    for (size_t j = (i + 1) & mask; top->slots[j] != 0; j = (j + 1) & mask) {
+        candidate *cur = &top->heap[top->slots[j] - 1];
+        size_t home = cur->hash & mask;
+        // Move j into the hole unless its home lies cyclically in (i, j]
+        bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays) {
+            top->slots[i] = top->slots[j];
+            top->slots[j] = 0;
+            cur->slot = i;
+            i = j;
+        }
+    }
+}
+
+// Function records the new estimate of a line. A line already in the heap
+// moves down as its estimate grows; a new line enters if the heap is not
+// full or it beats the smallest estimate, which is then evicted.
+void top_offer(top_heap *top, const char *line, size_t len, uint64_t hash, uint64_t estimate) {
+    size_t mask = top->nslots - 1;
+    size_t slot = hash & mask;
+    while (top->slots[slot] != 0) {
+        size_t pos = top->slots[slot] - 1;
+        candidate *cur = &top->heap[pos];
+        if (cur->hash == hash && cur->len == len && memcmp(cur->string, line, len) == 0) {
+            cur->estimate = estimate;
+            top_sift_down(top, pos);
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+    if (top->size == top->k && estimate <= top->heap[0].estimate) {
+        return;
+    }
+
+    candidate fresh = { .len = len, .hash = hash, .estimate = estimate, .slot = slot };
+    fresh.string = malloc(len + 1);
+    assert(fresh.string);
+    memcpy(fresh.string, line, len);
+    fresh.string[len] = '\0';
+
+    if (top->size < top->k) {
+        top->slots[slot] = ++top->size;
+        top_place(top, top->size - 1, fresh);
+        top_sift_up(top, top->size - 1);
+    } else {
+        // Evict the lightest candidate and reuse the root for the new line
+        free(top->heap[0].string);
+        top_unindex(top, top->heap[0].slot);
+        // the deletion may have shifted the probe run, so probe again
+        fresh.slot = hash & mask;
+        while (top->slots[fresh.slot] != 0) {
+            fresh.slot = (fresh.slot + 1) & mask;
+        }
+        top_place(top, 0, fresh);
+        top_sift_down(top, 0);
+    }
+}
+
+// Function turns the heap into an array sorted by decreasing estimate
+// (the index is no longer valid afterwards)
+void top_sort(top_heap *top) {
+    size_t size = top->size;
+    while (top->size > 1) {
+        candidate min = top->heap[0];
+        top->heap[0] = top->heap[--top->size];
+        top_sift_down(top, 0);
+        top->heap[top->size] = min;
+    }
+    top->size = size;
+}
+
+// Function frees the candidates and the heap
+void top_free(top_heap *top) {
+    for (size_t i = 0; i < top->size; i++) {
+        free(top->heap[i].string);
+    }
+    free(top->heap);
+    free(top->slots);
+}
+
+// Function prints every entry with its count, in first-seen order
+void print_table(const count_table *table) {
+    for (size_t i = 0; i < table->nentries; i++) {
+        printf("%7d %.*s\n", table->entries[i].count, (int)table->entries[i].len, table->entries[i].string);
+    }
+}
+
+// Function prints the number of times n lines occur in a file, in the order
+// each line first appears
+void print_uniq_lines(FILE *file_pointer) {
+    count_table table;
+    table_init(&table, true);
+
+    line_reader *reader = line_reader_open(fileno(file_pointer));
+    assert(reader);
+    line_view line;
+    while (line_reader_next(reader, &line)) {
+        size_t len = strnlen(line.ptr, line.len);  // key ends at a '\0'
+        table_add(&table, line.ptr, len, hash_line(line.ptr, len), 1);
+    }
+    line_reader_close(reader);
+    print_table(&table);
+    table_free(&table);
+}
+
+// Thread function: counts every line of one shard into the shard's table.
+// Lines are split on '\n' like line_reader, and a key stops at an embedded
+// '\0' just as in the serial version.
+void *count_shard(void *arg) {
+    shard *work = arg;
+    table_init(&work->table, false);
+    const char *line = work->start;
+    while (line < work->end) {
+        const char *newline = memchr(line, '\n', work->end - line);
+        const char *line_end = (newline != NULL) ? newline : work->end;
+        size_t len = strnlen(line, line_end - line);
+        table_add(&work->table, line, len, hash_line(line, len), 1);
+        line = line_end + 1;
+    }
+    return NULL;
+}
+
+// Function counts a regular file with nthreads threads. The file is mapped,
+// cut into nthreads shards that end on newlines, and each shard is counted
+// into a thread-local table with no locking. The tables are then merged in
+// shard order, which keeps every line at the position of its first
+// appearance in the file. Falls back to print_uniq_lines for inputs that
+// cannot be mapped (pipes, empty files).
+void print_uniq_lines_parallel(FILE *file_pointer, int nthreads) {
+    int fd = fileno(file_pointer);
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        print_uniq_lines(file_pointer);
+        return;
+    }
+    size_t size = st.st_size;
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        print_uniq_lines(file_pointer);
+        return;
+    }
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+
+    // Cut shards at the first newline after each even split point
+    shard *shards = malloc(nthreads * sizeof(shard));
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    assert(shards && threads);
+    const char *start = data;
+    for (int i = 0; i < nthreads; i++) {
+        const char *end = data + size;
+        if (i < nthreads - 1 && start < data + size) {
+            end = data + size / nthreads * (i + 1);
+            if (end < start) {
+                end = start;
             }
+            const char *newline = memchr(end, '\n', data + size - end);
+            end = (newline != NULL) ? newline + 1 : data + size;
+        }
+        shards[i].start = start;
+        shards[i].end = end;
+        start = end;
+        if (pthread_create(&threads[i], NULL, count_shard, &shards[i]) != 0) {
+            error(1, 0, "cannot create thread");
         }
-        // Add line to array
-        if (flag != 1) {
-            arr[uniqLineArr].string = line;  // add entry element to array
-            arr[uniqLineArr].count = 1;
-            uniqLineArr++;
+    }
+
+    // Merge shard tables in file order, reusing the stored hashes
+    count_table merged;
+    table_init(&merged, false);
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+        count_table *table = &shards[i].table;
+        for (size_t j = 0; j < table->nentries; j++) {
+            entry *cur = &table->entries[j];
+            table_add(&merged, cur->string, cur->len, cur->hash, cur->count);
         }
-        flag = 0;  // reset flag
     }
-    // Print array elements 
-    for (int i = 0; i < uniqLineArr; i++) {
-        printf("%7d %s\n", arr[i].count, arr[i].string);
-        free(arr[i].string);  // free line
+    print_table(&merged);
+
+    table_free(&merged);
+    for (int i = 0; i < nthreads; i++) {
+        table_free(&shards[i].table);
+    }
+    free(threads);
+    free(shards);
+    munmap((void *)data, size);
+}
+
+// Function prints the k heaviest lines of the stream in constant memory.
+// Every line updates a count-min sketch of SKETCH_DEPTH rows whose width is
+// set by the memory budget, giving an estimate that never undercounts and
+// overcounts by at most e * N / width with probability 1 - e^-depth (N is
+// the number of lines read). A min-heap of the k lines with the largest
+// estimates is kept alongside, with a small hash index to find lines that
+// are already in it. Lines are printed by decreasing estimate as
+// "estimate -bound line": the true count is within [estimate - bound,
+// estimate].
+void print_top_lines(FILE *file_pointer, size_t k, size_t budget) {
+    sketch cms;
+    sketch_init(&cms, budget);
+    top_heap top;
+    top_init(&top, k);
+    uint64_t nlines = 0;
+
+    line_reader *reader = line_reader_open(fileno(file_pointer));
+    assert(reader);
+    line_view line;
+    while (line_reader_next(reader, &line)) {
+        size_t len = strnlen(line.ptr, line.len);
+        uint64_t hash = hash_line(line.ptr, len);
+        top_offer(&top, line.ptr, len, hash, sketch_add(&cms, hash));
+        nlines++;
     }
-    free(arr);  // free entire array
+    line_reader_close(reader);
+
+    // Error bound of the sketch: ceil(e * N / width)
+    uint64_t bound = (uint64_t)ceil(M_E * nlines / cms.width);
+    top_sort(&top);
+    for (size_t i = 0; i < top.size; i++) {
+        candidate *cur = &top.heap[i];
+        uint64_t slack = (bound < cur->estimate) ? bound : cur->estimate;
+        printf("%7" PRIu64 " -%-6" PRIu64 " %.*s\n", cur->estimate, slack, (int)cur->len, cur->string);
+    }
+    top_free(&top);
+    free(cms.counters);
 }
 
+// Function converts the numeric argument of option name, exiting if it is
+// not a number in [1, max]
+long convert_arg(const char *str, long max, const char *name) {
+    char *end = NULL;
+    long parsed_number = strtol(str, &end, NUMERIC_ARG_BASE);
+    if (*str == '\0' || *end != '\0' || parsed_number < 1 || parsed_number > max) {
+        error(1, 0, "invalid %s '%s' (must be within [1, %ld])", name, str, max);
+    }
+    return parsed_number;
+}
 
 // ------- DO NOT EDIT ANY CODE BELOW THIS LINE (but do add comments!)  -------
 
 // open file and process arguments
 int main(int argc, char *argv[]) {
     FILE *file_pointer = NULL;
+    int nthreads = 1;
+    size_t top_k = 0;  // 0 means exact counting
+    size_t budget = DEFAULT_SKETCH_BUDGET;
+    // --threads counts with N threads, --top prints the K most frequent lines
+    // approximately, with a counting sketch of at most --memory bytes
+    static const struct option long_options[] = {
+        { "threads", required_argument, NULL, 't' },
+        { "top", required_argument, NULL, 'k' },
+        { "memory", required_argument, NULL, 'm' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    int opt = getopt_long(argc, argv, "", long_options, NULL);
+    while (opt != -1) {
+        if (opt == 't') {
+            nthreads = convert_arg(optarg, MAX_THREADS, "thread count");
+        } else if (opt == 'k') {
+            top_k = convert_arg(optarg, MAX_TOP_K, "top count");
+        } else if (opt == 'm') {
+            budget = convert_arg(optarg, MAX_SKETCH_BUDGET, "memory budget");
+        } else {
+            return 1;
+        }
+        opt = getopt_long(argc, argv, "", long_options, NULL);
+    }
 
-    if (argc == 1) {
+    if (optind == argc) {
         file_pointer = stdin;
     } else {
-        file_pointer = fopen(argv[1], "r");
+        file_pointer = fopen(argv[optind], "r");
         if (file_pointer == NULL) {
-            error(1, errno, "cannot access '%s'", argv[1]);
+            error(1, errno, "cannot access '%s'", argv[optind]);
         }
     }
 
-    print_uniq_lines(file_pointer);
+    if (top_k > 0) {
+        print_top_lines(file_pointer, top_k, budget);
+    } else if (nthreads > 1) {
+        print_uniq_lines_parallel(file_pointer, nthreads);
+    } else {
+        print_uniq_lines(file_pointer);
+    }
     fclose(file_pointer);
     return 0;
 }
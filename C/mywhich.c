@@ -2,62 +2,661 @@
  *  It can receive a specific exectuable file as input and will return
  *  the path to the location of that file. If no path is provided by user,
  *  the program uses the current environment path.
+ *  When many names are looked up at once (or MYWHICH_CACHE names a cache
+ *  file), every search path directory is listed once into a hash table of
+ *  names, so each name costs one access() call instead of one per
+ *  directory. The cache stores that index keyed by the directories'
+ *  modification times, so later runs can skip listing them.
+ *  Directories are probed (or listed) in search path order by a worker
+ *  thread, so that a directory that does not answer within
+ *  MYWHICH_TIMEOUT_MS milliseconds (e.g. a hung network mount) can be
+ *  skipped instead of stalling every lookup: a new worker then carries on
+ *  from the next directory, leaving the stuck one behind.
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include "samples/prototypes.h"
 
 #define SLASH "/"
+#define MAX_DIRS 1024  // search path directories considered
+#define INDEX_MIN_ARGS 8  // names needed before listing directories pays off
+#define DENTS_BUFFER_SIZE (64 * 1024)
+#define INITIAL_SLOTS 4096  // power of two
+#define CACHE_MAGIC "mywhich-index 1"
+#define NO_DIR UINT32_MAX
+#define DEFAULT_TIMEOUT_MS 2000  // per directory, see MYWHICH_TIMEOUT_MS
+#define PROBE_STACK_SIZE (256 * 1024)
 
+/*  Record layout returned by the getdents64 system call
+ */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/*  A directory of the search path. indexed is false if it could not be
+ *  listed (e.g. execute-only), in which case names are probed in it
+ *  directly. mtime is what the cache is keyed on. timed_out is set once
+ *  the directory failed to answer in time; it is skipped from then on.
+ */
+typedef struct search_dir {
+    char path[PATH_MAX];
+    bool indexed;
+    struct timespec mtime;
+    bool timed_out;
+} search_dir;
+
+/*  The tasks a probe thread can run on its directory
+ */
+enum { TASK_STAT, TASK_LIST, TASK_PROBE };
+
+/*  What a worker found out about a directory. The worker fills it in and
+ *  then sets done under the pool lock; the main thread only reads a result
+ *  after seeing done, and gives up on it at its deadline.
+ */
+typedef struct dir_result {
+    bool done;
+    bool ok;  // directory could be stat'ed (TASK_STAT) or listed (TASK_LIST)
+    struct timespec mtime;
+    char *names;  // TASK_LIST: every name, each followed by '\0'
+    size_t names_len;
+    bool *hits;  // TASK_PROBE: hits[i] is true if args[i] is found here
+} dir_result;
+
+/*  One round of background work: a task run on the search directories in
+ *  order by one worker at a time. The current worker is the one whose
+ *  generation matches; a worker left behind on a hung directory sees that
+ *  it no longer does and exits when (if ever) it returns. Pools are never
+ *  freed, because such a worker may still write into its result after the
+ *  main thread moved on.
+ */
+typedef struct probe_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;  // uses CLOCK_MONOTONIC
+    int task;
+    const search_dir *dirs;
+    size_t ndirs;
+    dir_result *results;
+    char **args;
+    int nargs;
+    bool *found;  // TASK_PROBE: found[i] is true once args[i] was found
+    int nfound;
+    size_t next;  // next directory for the current worker
+    size_t current;  // directory the current worker is on, or ndirs if none
+    bool finished;  // the current worker has exited
+    struct timespec current_start;  // when it started on it
+    unsigned generation;
+    long timeout_ms;
+} probe_pool;
+
+typedef struct probe_work {
+    probe_pool *pool;
+    unsigned generation;
+} probe_work;
+
+/*  Hash table from file name to the first indexed directory containing it.
+ *  Names live in one growing arena; slots hold entry index + 1 (0 = empty).
+ */
+typedef struct name_entry {
+    uint64_t hash;
+    uint32_t name;  // offset in the arena
+    uint32_t dir;
+} name_entry;
+
+typedef struct name_index {
+    char *arena;
+    size_t arena_len;
+    size_t arena_cap;
+    name_entry *entries;
+    size_t nentries;
+    size_t entries_cap;
+    uint32_t *slots;
+    size_t nslots;
+} name_index;
+
+/*  Function returns true if exe in dir exists, is readable and may be
+ *  executed (the test mywhich has always used)
+ */
+bool probe(const char *dir, const char *exe) {
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s" SLASH "%s", dir, exe) >= (int)sizeof(path)) {
+        return false;
+    }
+    return access(path, (R_OK | X_OK)) == 0;
+}
+
+/*  Function hashes a name with 64-bit FNV-1a
+ */
+uint64_t hash_name(const char *name, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*  Function doubles the slots of the index, placing entries again by their
+ *  stored hashes
+ */
+void index_grow(name_index *index) {
+    size_t nslots = (index->nslots == 0) ? INITIAL_SLOTS : 2 * index->nslots;
+    uint32_t *slots = calloc(nslots, sizeof(uint32_t));
+    if (slots == NULL) {
+        perror("mywhich");
+        exit(1);
+    }
+    for (size_t i = 0; i < index->nentries; i++) {
+        size_t slot = index->entries[i].hash & (nslots - 1);
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (nslots - 1);
+        }
+        slots[slot] = i + 1;
+    }
+    free(index->slots);
+    index->slots = slots;
+    index->nslots = nslots;
+}
+
+/*  Function returns the slot holding name, or the empty slot where it
+ *  would go
+ */
+size_t index_find(const name_index *index, const char *name, size_t len, uint64_t hash) {
+    size_t slot = hash & (index->nslots - 1);
+    while (index->slots[slot] != 0) {
+        const name_entry *cur = &index->entries[index->slots[slot] - 1];
+        const char *cur_name = index->arena + cur->name;
+        if (cur->hash == hash && strncmp(cur_name, name, len) == 0 && cur_name[len] == '\0') {
+            break;
+        }
+        slot = (slot + 1) & (index->nslots - 1);
+    }
+    return slot;
+}
+
+/*  Function records that name is found in directory dir, unless an earlier
+ *  directory already has it (earlier directories win, as in PATH order)
+ */
+void index_add(name_index *index, const char *name, uint32_t dir) {
+    if (index->nentries * 2 >= index->nslots) {
+        index_grow(index);
+    }
+    size_t len = strlen(name);
+    uint64_t hash = hash_name(name, len);
+    size_t slot = index_find(index, name, len, hash);
+    if (index->slots[slot] != 0) {
+        return;
+    }
+    if (index->arena_cap - index->arena_len < len + 1) {
+        index->arena_cap = 2 * (index->arena_cap + len + 1);
+        index->arena = realloc(index->arena, index->arena_cap);
+    }
+    if (index->nentries == index->entries_cap) {
+        index->entries_cap = (index->entries_cap == 0) ? INITIAL_SLOTS : 2 * index->entries_cap;
+        index->entries = realloc(index->entries, index->entries_cap * sizeof(name_entry));
+    }
+    if (index->arena == NULL || index->entries == NULL || index->arena_cap > UINT32_MAX) {
+        perror("mywhich");
+        exit(1);
+    }
+    name_entry *entry = &index->entries[index->nentries];
+    entry->hash = hash;
+    entry->name = index->arena_len;
+    entry->dir = dir;
+    memcpy(index->arena + index->arena_len, name, len + 1);
+    index->arena_len += len + 1;
+    index->slots[slot] = ++index->nentries;
+}
 
+/*  Function returns the first indexed directory holding name, or NO_DIR
+ */
+uint32_t index_lookup(const name_index *index, const char *name) {
+    if (index->nslots == 0) {
+        return NO_DIR;
+    }
+    size_t len = strlen(name);
+    size_t slot = index_find(index, name, len, hash_name(name, len));
+    return (index->slots[slot] != 0) ? index->entries[index->slots[slot] - 1].dir : NO_DIR;
+}
 
-/*  Function takes a directory and appends the name of an executable
- *  at the end.
+/*  Function lists the directory at path with getdents64 into result as
+ *  a run of '\0'-terminated names. result->ok stays false if it cannot be
+ *  read completely, or holds a name the cache could not store.
  */
-void appendToPath(char *dir, char *exe) {
-    strcat(dir, SLASH);  // slash before executable name
-    strcat(dir, exe);
+void list_dir(const char *path, dir_result *result) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return;
+    }
+    result->mtime = st.st_mtim;
+    size_t cap = DENTS_BUFFER_SIZE;
+    result->names = malloc(cap);
+    char *buf = malloc(DENTS_BUFFER_SIZE);
+    long nread = (result->names != NULL && buf != NULL) ? 0 : -1;
+    while (nread != -1 && (nread = syscall(SYS_getdents64, fd, buf, DENTS_BUFFER_SIZE)) > 0) {
+        for (long offset = 0; offset < nread; ) {
+            struct linux_dirent64 *dent = (struct linux_dirent64 *)(buf + offset);
+            offset += dent->d_reclen;
+            size_t len = strlen(dent->d_name) + 1;
+            if (strchr(dent->d_name, '\n') != NULL) {
+                nread = -1;
+                break;
+            }
+            if (cap - result->names_len < len) {
+                cap *= 2;
+                result->names = realloc(result->names, cap);
+                if (result->names == NULL) {
+                    nread = -1;
+                    break;
+                }
+            }
+            memcpy(result->names + result->names_len, dent->d_name, len);
+            result->names_len += len;
+        }
+    }
+    result->ok = nread == 0;
+    free(buf);
+    close(fd);
+}
+
+/*  Function runs the pool's task on directory dir. Names already found
+ *  in an earlier directory are not probed again.
+ */
+void run_task(probe_pool *pool, size_t dir) {
+    const char *path = pool->dirs[dir].path;
+    dir_result *result = &pool->results[dir];
+    struct stat st;
+
+    if (pool->task == TASK_STAT) {
+        result->ok = stat(path, &st) == 0;
+        if (result->ok) {
+            result->mtime = st.st_mtim;
+        } else {
+            memset(&result->mtime, 0, sizeof(result->mtime));
+        }
+    } else if (pool->task == TASK_LIST) {
+        list_dir(path, result);
+    } else {
+        for (int i = 0; i < pool->nargs; i++) {
+            result->hits[i] = !pool->found[i] && probe(path, pool->args[i]);
+        }
+    }
+}
+
+/*  Thread function: runs the pool's task on the directories in order, as
+ *  long as it is the current worker. A probing worker stops once every
+ *  name has been found, since later directories cannot change the output.
+ */
+void *probe_thread(void *arg) {
+    probe_work *work = arg;
+    probe_pool *pool = work->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->generation == work->generation && pool->next < pool->ndirs
+           && (pool->task != TASK_PROBE || pool->nfound < pool->nargs)) {
+        size_t dir = pool->next++;
+        if (pool->dirs[dir].timed_out) {
+            continue;
+        }
+        pool->current = dir;
+        clock_gettime(CLOCK_MONOTONIC, &pool->current_start);
+        pthread_cond_broadcast(&pool->cond);  // waiters take up the new deadline
+        pthread_mutex_unlock(&pool->lock);
+
+        run_task(pool, dir);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->results[dir].done = true;
+        if (pool->generation == work->generation && pool->task == TASK_PROBE) {
+            for (int i = 0; i < pool->nargs; i++) {
+                if (pool->results[dir].hits[i]) {
+                    pool->found[i] = true;
+                    pool->nfound++;
+                }
+            }
+        }
+        pthread_cond_broadcast(&pool->cond);
+    }
+    if (pool->generation == work->generation) {
+        pool->current = pool->ndirs;
+        pool->finished = true;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    free(work);
+    return NULL;
+}
+
+/*  Function starts a new current worker at pool->next. Called with the
+ *  pool lock held (or before the pool is shared).
+ */
+void start_worker(probe_pool *pool) {
+    probe_work *work = malloc(sizeof(probe_work));
+    if (work == NULL) {
+        perror("mywhich");
+        exit(1);
+    }
+    work->pool = pool;
+    work->generation = ++pool->generation;
+    pool->current = pool->ndirs;
+    pool->finished = false;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, PROBE_STACK_SIZE);
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, probe_thread, work) != 0) {
+        perror("mywhich");
+        exit(1);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/*  Function sets up a pool running task on the search directories (except
+ *  those that already timed out), each allowed timeout_ms milliseconds,
+ *  and starts its worker
+ */
+probe_pool *start_pool(int task, const search_dir *dirs, size_t ndirs, char **args, int nargs, long timeout_ms) {
+    probe_pool *pool = calloc(1, sizeof(probe_pool));
+    if (pool == NULL || (pool->results = calloc(ndirs, sizeof(dir_result))) == NULL
+        || (pool->found = calloc(nargs + 1, sizeof(bool))) == NULL) {
+        perror("mywhich");
+        exit(1);
+    }
+    pthread_condattr_t condattr;
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, &condattr);
+    pthread_condattr_destroy(&condattr);
+    pool->task = task;
+    pool->dirs = dirs;
+    pool->ndirs = ndirs;
+    pool->args = args;
+    pool->nargs = nargs;
+    pool->timeout_ms = timeout_ms;
+    for (size_t i = 0; task == TASK_PROBE && i < ndirs; i++) {
+        pool->results[i].hits = calloc(nargs, sizeof(bool));
+        if (pool->results[i].hits == NULL) {
+            perror("mywhich");
+            exit(1);
+        }
+    }
+    start_worker(pool);
+    return pool;
+}
+
+/*  Function waits until directory dir has finished its task. While it
+ *  waits, a directory the worker has spent more than the timeout on is
+ *  marked timed out (and reported once), and a new worker is started past
+ *  it. Returns dir's result, or NULL if dir timed out (or was never run,
+ *  as a probing worker stops once every name is found).
+ */
+const dir_result *wait_dir(probe_pool *pool, search_dir *dirs, size_t dir) {
+    pthread_mutex_lock(&pool->lock);
+    while (!dirs[dir].timed_out && !pool->results[dir].done && !pool->finished) {
+        if (pool->current == pool->ndirs) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+            continue;
+        }
+        size_t stuck = pool->current;
+        struct timespec deadline = pool->current_start;
+        deadline.tv_sec += pool->timeout_ms / 1000;
+        deadline.tv_nsec += (pool->timeout_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        if (pthread_cond_timedwait(&pool->cond, &pool->lock, &deadline) == ETIMEDOUT
+            && pool->current == stuck && !pool->results[stuck].done) {
+            dirs[stuck].timed_out = true;
+            fprintf(stderr, "mywhich: skipping %s: no response\n", dirs[stuck].path);
+            pool->next = stuck + 1;
+            start_worker(pool);
+        }
+    }
+    const dir_result *result = (pool->results[dir].done && !dirs[dir].timed_out) ? &pool->results[dir] : NULL;
+    pthread_mutex_unlock(&pool->lock);
+    return result;
+}
+
+/*  Function lists every search directory in the background and builds the
+ *  index from the listings in search path order. Directories that cannot be
+ *  listed are left unindexed and those that time out are skipped.
+ */
+void build_index(name_index *index, search_dir *dirs, size_t ndirs, long timeout_ms) {
+    probe_pool *pool = start_pool(TASK_LIST, dirs, ndirs, NULL, 0, timeout_ms);
+    for (size_t i = 0; i < ndirs; i++) {
+        const dir_result *result = wait_dir(pool, dirs, i);
+        dirs[i].indexed = result != NULL && result->ok;
+        if (!dirs[i].indexed) {
+            continue;
+        }
+        dirs[i].mtime = result->mtime;
+        for (size_t offset = 0; offset < result->names_len; offset += strlen(result->names + offset) + 1) {
+            index_add(index, result->names + offset, i);
+        }
+    }
+}
+
+/*  Function loads the index from the cache file if it was written for the
+ *  same search path and no directory has been modified since (the current
+ *  mtimes are gathered in the background meanwhile). Returns false (with the index
+ *  left empty) if the cache cannot be used.
+ */
+bool load_cache(const char *cache_path, name_index *index, search_dir *dirs, size_t ndirs, long timeout_ms) {
+    FILE *fp = fopen(cache_path, "r");
+    if (fp == NULL) {
+        return false;
+    }
+    probe_pool *pool = start_pool(TASK_STAT, dirs, ndirs, NULL, 0, timeout_ms);
+    char *line = NULL;
+    size_t cap = 0;
+    bool valid = getline(&line, &cap, fp) > 0 && strcmp(line, CACHE_MAGIC "\n") == 0;
+    size_t cached_ndirs = 0;
+    valid = valid && fscanf(fp, "%zu\n", &cached_ndirs) == 1 && cached_ndirs == ndirs;
+
+    // One line per directory: indexed flag, mtime, path
+    for (size_t i = 0; valid && i < ndirs; i++) {
+        int indexed = 0;
+        long long sec = 0;
+        long nsec = 0;
+        int path_start = 0;
+        const dir_result *result = NULL;
+        ssize_t len = getline(&line, &cap, fp);
+        valid = len > 0 && sscanf(line, "%d %lld %ld %n", &indexed, &sec, &nsec, &path_start) == 3;
+        if (valid) {
+            line[len - 1] = '\0';
+            valid = strcmp(line + path_start, dirs[i].path) == 0;
+        }
+        if (valid && indexed) {
+            result = wait_dir(pool, dirs, i);
+            valid = result != NULL && result->ok && result->mtime.tv_sec == sec && result->mtime.tv_nsec == nsec;
+            dirs[i].mtime = valid ? result->mtime : dirs[i].mtime;
+        }
+        dirs[i].indexed = indexed;
+    }
+
+    // Then one line per name: directory number, name
+    ssize_t len;
+    while (valid && (len = getline(&line, &cap, fp)) > 0) {
+        char *name = NULL;
+        unsigned long dir = strtoul(line, &name, 10);
+        valid = *name == ' ' && line[len - 1] == '\n' && dir < ndirs && dirs[dir].indexed;
+        if (valid) {
+            line[len - 1] = '\0';
+            index_add(index, name + 1, dir);
+        }
+    }
+    free(line);
+    fclose(fp);
+    if (!valid) {
+        index->nentries = index->arena_len = 0;
+        memset(index->slots, 0, index->nslots * sizeof(uint32_t));
+    }
+    return valid;
+}
+
+/*  Function writes the index to the cache file (through a temporary file
+ *  renamed into place, so readers never see a partial cache). Names of
+ *  unindexed directories are left out, as load_cache rejects the whole cache
+ *  over any of them. Failures are ignored: the cache is only an optimization.
+ */
+void save_cache(const char *cache_path, const name_index *index, const search_dir *dirs, size_t ndirs) {
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d", cache_path, (int)getpid()) >= (int)sizeof(tmp_path)) {
+        return;
+    }
+    FILE *fp = fopen(tmp_path, "w");
+    if (fp == NULL) {
+        return;
+    }
+    fprintf(fp, "%s\n%zu\n", CACHE_MAGIC, ndirs);
+    for (size_t i = 0; i < ndirs; i++) {
+        fprintf(fp, "%d %lld %ld %s\n", dirs[i].indexed, (long long)dirs[i].mtime.tv_sec,
+                dirs[i].mtime.tv_nsec, dirs[i].path);
+    }
+    for (size_t i = 0; i < index->nentries; i++) {
+        if (dirs[index->entries[i].dir].indexed) {
+            fprintf(fp, "%u %s\n", index->entries[i].dir, index->arena + index->entries[i].name);
+        }
+    }
+    if (fclose(fp) != 0 || rename(tmp_path, cache_path) != 0) {
+        unlink(tmp_path);
+    }
+}
+
+/*  Function prints where exe is found using the index: only unindexed
+ *  directories and the first indexed directory listing the name need an
+ *  access() check. If that check fails (e.g. the file is not executable),
+ *  the remaining directories are probed one by one as without the index.
+ */
+void find_indexed(const name_index *index, const search_dir *dirs, size_t ndirs, const char *exe) {
+    uint32_t candidate = index_lookup(index, exe);
+    bool probe_rest = false;
+    for (size_t i = 0; i < ndirs; i++) {
+        if (dirs[i].timed_out) {
+            continue;
+        }
+        if (probe_rest || !dirs[i].indexed || i == candidate) {
+            if (probe(dirs[i].path, exe)) {
+                printf("%s" SLASH "%s\n", dirs[i].path, exe);
+                return;
+            }
+            probe_rest = probe_rest || i == candidate;
+        }
+    }
+}
+
+/*  Function probes the names in the directories in the background and
+ *  prints, for each name, the first directory in search path order that
+ *  has it
+ */
+void find_all_in_background(search_dir *dirs, size_t ndirs, char **args, int nargs, long timeout_ms) {
+    probe_pool *pool = start_pool(TASK_PROBE, dirs, ndirs, args, nargs, timeout_ms);
+    for (int i = 0; i < nargs; i++) {
+        for (size_t j = 0; j < ndirs; j++) {
+            const dir_result *result = wait_dir(pool, dirs, j);
+            if (result != NULL && result->hits[i]) {
+                printf("%s" SLASH "%s\n", dirs[j].path, args[i]);
+                break;
+            }
+        }
+    }
+}
+
+/*  Function prints where exe is found by probing each directory in order
+ */
+void find_probing(const search_dir *dirs, size_t ndirs, const char *exe) {
+    for (size_t i = 0; i < ndirs; i++) {
+        if (!dirs[i].timed_out && probe(dirs[i].path, exe)) {
+            printf("%s" SLASH "%s\n", dirs[i].path, exe);
+            return;
+        }
+    }
 }
 
 int main(int argc, char *argv[], const char *envp[]) {
     // Get value of environment variable
     const char *searchpath = get_env_value(envp, "MYPATH");
     char dir[PATH_MAX];
-    
+
     // If MYPATH is not an environment variable, use default PATH
     if (searchpath == NULL) {
         searchpath = get_env_value(envp, "PATH");
     }
-    
+
     // If no input from the user, print all contents in path
     if (argc == 1) {
         const char *remaining = searchpath;
-        printf("%s\n", "Directories in search path:"); 
+        printf("%s\n", "Directories in search path:");
         while (scan_token(&remaining, ":", dir, sizeof(dir))) {
             printf("%s\n", dir);
         }
 
     // Find location of user input
     } else {
+        // Split the search path once, not once per argument
+        static search_dir dirs[MAX_DIRS];
+        size_t ndirs = 0;
+        const char *remaining = searchpath;
+        while (ndirs < MAX_DIRS && scan_token(&remaining, ":", dirs[ndirs].path, sizeof(dirs[ndirs].path))) {
+            dirs[ndirs].indexed = dirs[ndirs].timed_out = false;
+            ndirs++;
+        }
+        const char *timeout_value = get_env_value(envp, "MYWHICH_TIMEOUT_MS");
+        long timeout_ms = (timeout_value != NULL) ? atol(timeout_value) : DEFAULT_TIMEOUT_MS;
+        if (timeout_ms <= 0) {
+            timeout_ms = DEFAULT_TIMEOUT_MS;
+        }
+
+        const char *cache_path = get_env_value(envp, "MYWHICH_CACHE");
+        if (cache_path == NULL && argc - 1 < INDEX_MIN_ARGS) {
+            find_all_in_background(dirs, ndirs, argv + 1, argc - 1, timeout_ms);
+            return 0;
+        }
+
+        // Build the index (or load it from a valid cache), then answer all
+        name_index index = { 0 };
+        index_grow(&index);
+        if (cache_path == NULL || !load_cache(cache_path, &index, dirs, ndirs, timeout_ms)) {
+            build_index(&index, dirs, ndirs, timeout_ms);
+            bool complete = true;
+            for (size_t i = 0; i < ndirs; i++) {
+                complete = complete && !dirs[i].timed_out;
+            }
+            if (cache_path != NULL && complete) {
+                save_cache(cache_path, &index, dirs, ndirs);
+            }
+        }
         // Want to start i=1 (argv[1]), since argv[0] is location of this file
         for (int i = 1; i < argc; i++) {
-            const char *remaining = searchpath;  // path gets reset for each argument
-
-            // Loop through all paths in remaining (searchpath) 
-            while (scan_token(&remaining, ":", dir, sizeof(dir))) {
-                
-                appendToPath(dir, argv[i]);  // append argument to path
-                
-                // Print path if argument exists, is readable, and access is permitted
-                if (access(dir, (R_OK | X_OK)) == 0) {
-                    printf("%s\n", dir);
-                    break;  // move to next argument
-                }
+            if (strchr(argv[i], '/') != NULL) {
+                find_probing(dirs, ndirs, argv[i]);  // not a plain file name
+            } else {
+                find_indexed(&index, dirs, ndirs, argv[i]);
             }
-        } 
+        }
     }
     return 0;
 }
@@ -0,0 +1,239 @@
+/*  LD_PRELOAD shim that runs unmodified programs on one of our heap
+ *  allocators (bump.c, implicit.c or explicit.c) by exporting the C
+ *  library's allocation functions on top of its mymalloc interface.
+ *
+ *  Every pointer handed out is preceded by a 16-byte tag holding the
+ *  block mymalloc returned and the requested size. That lets the shim
+ *  honour the 16-byte alignment (and memalign's larger alignments) that
+ *  programs expect, and answer malloc_usable_size. The allocator's heap
+ *  segment is set up on the first call, sized by PRELOAD_HEAP_SIZE
+ *  (bytes, default 4 GB of address space). One mutex serializes all
+ *  calls. Allocations made while the shim is already running on the same
+ *  thread (e.g. by the C library during setup, or by the first backtrace
+ *  of allocprof.c, which loads libgcc) must not wait for that mutex: they
+ *  come from a small static bootstrap arena instead, and are never freed.
+ *  Frees made there are dropped, as the allocator is mid-call.
+ *
+ *  Build, with ALLOCATOR one of bump.c, implicit.c, explicit.c:
+ *    gcc -std=gnu99 -O2 -shared -fPIC -fvisibility=hidden -o libmyalloc.so \
+ *        preload.c ALLOCATOR segment.c allocprof.c -lm -ldl -pthread
+ *  (allocprof.c is only needed with explicit.c.) Then compare, e.g.:
+ *    time ./mysort big.txt > /dev/null
+ *    LD_PRELOAD=./libmyalloc.so time ./mysort big.txt > /dev/null
+ *  preload_test.sh runs a few programs on each allocator, with profiling.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./allocator.h"
+#include "./segment.h"
+
+#define EXPORT __attribute__((visibility("default")))
+#define TAG_SIZE 16  // also the alignment of every pointer handed out
+#define DEFAULT_HEAP_SIZE (4UL << 30)
+#define BOOTSTRAP_SIZE (256 * 1024)
+
+/*  Struct definition for the tag before each user pointer.
+ *  raw is what mymalloc returned (NULL for bootstrap blocks).
+ */
+typedef struct tag {
+    void *raw;
+    size_t size;
+} tag;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t bootstrap_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool heap_ready;
+static bool heap_failed;
+static __thread bool in_shim __attribute__((tls_model("initial-exec")));
+
+static _Alignas(TAG_SIZE) char bootstrap[BOOTSTRAP_SIZE];
+static size_t bootstrap_used;
+
+/*  Function: tag_of
+ *  ----------------
+ *  Helper function that returns the tag of a pointer handed out by the shim.
+ */
+static tag *tag_of(void *ptr) {
+    return (tag *)((char *)ptr - TAG_SIZE);
+}
+
+/*  Function: init_heap
+ *  -------------------
+ *  Helper function that reserves the heap segment and initializes the allocator
+ *  on first use. Called with heap_lock held.
+ */
+static bool init_heap(void) {
+    if (!heap_ready && !heap_failed) {
+        const char *size_value = getenv("PRELOAD_HEAP_SIZE");
+        size_t heap_size = (size_value != NULL && atol(size_value) > 0) ? (size_t)atol(size_value) : DEFAULT_HEAP_SIZE;
+        void *heap_start = init_heap_segment(heap_size);
+        heap_ready = heap_start != NULL && myinit(heap_start, heap_size);
+        heap_failed = !heap_ready;
+    }
+    return heap_ready;
+}
+
+/*  Function: bootstrap_alloc
+ *  -------------------------
+ *  Helper function that places a tagged block of size bytes, aligned to align, in
+ *  the bootstrap arena. Takes only bootstrap_lock, as the calling thread may
+ *  already hold heap_lock.
+ */
+static void *bootstrap_alloc(size_t size, size_t align) {
+    void *ptr = NULL;
+    pthread_mutex_lock(&bootstrap_lock);
+    size_t start = (bootstrap_used + TAG_SIZE + align - 1) & ~(align - 1);
+    if (size <= BOOTSTRAP_SIZE && start <= BOOTSTRAP_SIZE - size) {
+        bootstrap_used = start + size;
+        ptr = bootstrap + start;
+        tag_of(ptr)->raw = NULL;
+        tag_of(ptr)->size = size;
+    }
+    pthread_mutex_unlock(&bootstrap_lock);
+    return ptr;
+}
+
+/*  Function: tagged_alloc
+ *  ----------------------
+ *  Helper function that allocates size bytes aligned to align (a power of two, at
+ *  least TAG_SIZE) with room for the tag before them. The allocators align to
+ *  ALIGNMENT, so up to align - ALIGNMENT bytes of slack are requested.
+ */
+static void *tagged_alloc(size_t size, size_t align) {
+    size_t slack = TAG_SIZE + align - ALIGNMENT;
+    if (size > SIZE_MAX - slack) {
+        return NULL;
+    }
+    if (in_shim) {
+        return bootstrap_alloc(size, align);  // this thread holds heap_lock
+    }
+    pthread_mutex_lock(&heap_lock);
+    in_shim = true;
+    void *ptr = NULL;
+    char *raw = init_heap() ? mymalloc(size + slack) : NULL;
+    if (raw != NULL) {
+        ptr = (void *)(((uintptr_t)raw + TAG_SIZE + align - 1) & ~(uintptr_t)(align - 1));
+        tag_of(ptr)->raw = raw;
+        tag_of(ptr)->size = size;
+    }
+    in_shim = false;
+    pthread_mutex_unlock(&heap_lock);
+    return ptr;
+}
+
+EXPORT void *malloc(size_t size) {
+    void *ptr = tagged_alloc((size == 0) ? 1 : size, TAG_SIZE);
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+EXPORT void free(void *ptr) {
+    if (ptr == NULL || tag_of(ptr)->raw == NULL || in_shim) {
+        return;  // bootstrap blocks are never reused, and re-entrant frees leak
+    }
+    pthread_mutex_lock(&heap_lock);
+    in_shim = true;
+    myfree(tag_of(ptr)->raw);
+    in_shim = false;
+    pthread_mutex_unlock(&heap_lock);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    // Not malloc + memset, which the compiler may turn back into a calloc call
+    size_t total = (nmemb * size == 0) ? 1 : nmemb * size;
+    void *ptr = tagged_alloc(total, TAG_SIZE);
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    } else {
+        memset(ptr, 0, total);  // freed blocks are reused as they are
+    }
+    return ptr;
+}
+
+/*  Function: realloc
+ *  -----------------
+ *  Resizes through myrealloc, so the allocator can grow blocks in place. The user
+ *  pointer's offset within the raw block depends on the raw block's alignment, so
+ *  if the block moved to a differently aligned address the bytes slide to match.
+ */
+EXPORT void *realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    tag *old_tag = tag_of(ptr);
+    size_t keep = (old_tag->size < size) ? old_tag->size : size;
+    if (old_tag->raw == NULL || in_shim || size > SIZE_MAX - BOOTSTRAP_SIZE) {
+        void *new_ptr = malloc(size);
+        if (new_ptr != NULL) {
+            memcpy(new_ptr, ptr, keep);
+            free(ptr);
+        }
+        return new_ptr;
+    }
+
+    pthread_mutex_lock(&heap_lock);
+    in_shim = true;
+    // Room for the old offset (to preserve the bytes) and for the new one
+    size_t offset = (char *)ptr - (char *)old_tag->raw;
+    size_t max_offset = TAG_SIZE + TAG_SIZE - ALIGNMENT;
+    char *raw = myrealloc(old_tag->raw, size + ((offset > max_offset) ? offset : max_offset));
+    char *new_ptr = NULL;
+    if (raw != NULL) {
+        new_ptr = (char *)(((uintptr_t)raw + TAG_SIZE + TAG_SIZE - 1) & ~(uintptr_t)(TAG_SIZE - 1));
+        if (new_ptr != raw + offset) {
+            memmove(new_ptr, raw + offset, keep);
+        }
+        tag_of(new_ptr)->raw = raw;
+        tag_of(new_ptr)->size = size;
+    }
+    in_shim = false;
+    pthread_mutex_unlock(&heap_lock);
+    if (new_ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return new_ptr;
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *ptr = tagged_alloc((size == 0) ? 1 : size, (alignment < TAG_SIZE) ? TAG_SIZE : alignment);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+EXPORT void *memalign(size_t alignment, size_t size) {
+    void *ptr = NULL;
+    int err = posix_memalign(&ptr, (alignment < sizeof(void *)) ? sizeof(void *) : alignment, size);
+    if (err != 0) {
+        errno = err;
+    }
+    return ptr;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+EXPORT size_t malloc_usable_size(void *ptr) {
+    return (ptr == NULL) ? 0 : tag_of(ptr)->size;
+}
@@ -3,21 +3,40 @@
  * Handles low-level storage underneath the heap allocator. It reserves
  * the large memory segment using the OS-level mmap facility.
  *
+ * Large heaps can spend much of their time on TLB misses with 4 KB pages,
+ * so the segment can be backed by 2 MB huge pages, chosen with the
+ * HEAP_HUGEPAGES environment variable:
+ *   off      plain pages (the default)
+ *   hot      align the segment to 2 MB and ask for transparent huge pages
+ *            on its first HEAP_HOT_REGION bytes (default 8 MB), where the
+ *            first-fit allocators place the small, early, hot objects
+ *   all      align the segment and ask for transparent huge pages on all
+ *   hugetlb  map it from the hugetlbfs pool (MAP_HUGETLB), falling back
+ *            to "all" when the pool has no room
+ *
  * Written by jzelenski, updated Spring 2018
  */
 
 #include "segment.h"
 #include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 
 /* Place segment at fixed address, as default addresses are quite high
  * and easily mistaken for stack addresses.
  */
 #define HEAP_START_HINT (void *)0x107000000L
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024L)
+#define DEFAULT_HOT_REGION (8 * 1024 * 1024L)
+
+enum { HUGE_OFF, HUGE_HOT, HUGE_ALL, HUGE_HUGETLB };
 
 // Static means these variables are only visible within this file
 static void *segment_start = NULL;
 static size_t segment_size = 0;
+static size_t mapping_size = 0;  // length mapped: segment_size, or whole huge pages
 
 void *heap_segment_start() {
     return segment_start;
@@ -27,16 +46,71 @@ size_t heap_segment_size() {
     return segment_size;
 }
 
+/* Reads the huge page mode from HEAP_HUGEPAGES.
+ */
+static int huge_page_mode(void) {
+    const char *mode = getenv("HEAP_HUGEPAGES");
+    if (mode == NULL) return HUGE_OFF;
+    if (strcmp(mode, "hot") == 0) return HUGE_HOT;
+    if (strcmp(mode, "all") == 0) return HUGE_ALL;
+    if (strcmp(mode, "hugetlb") == 0) return HUGE_HUGETLB;
+    return HUGE_OFF;
+}
+
+/* Maps size bytes starting at a 2 MB boundary, by mapping 2 MB more than
+ * needed and unmapping the unaligned head and the excess tail.
+ */
+static void *map_aligned(size_t size) {
+    char *raw = mmap(HEAP_START_HINT, size + HUGE_PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return MAP_FAILED;
+    char *start = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (start > raw) munmap(raw, start - raw);
+    size_t tail = (raw + size + HUGE_PAGE_SIZE) - (start + size);
+    if (tail > 0) munmap(start + size, tail);
+    return start;
+}
+
 void *init_heap_segment(size_t total_size) {
-    // Discard any previous segment via munmap
+    // Discard any previous segment via munmap (of its own size, not the new one)
     if (segment_start != NULL) {
-        if (munmap(segment_start, total_size) == -1) return NULL;
+        if (munmap(segment_start, mapping_size) == -1) return NULL;
         segment_start = NULL;
         segment_size = 0;
+        mapping_size = 0;
     }
-    
+
     // Re-initialize by reserving entire segment with mmap
-    segment_start = mmap(HEAP_START_HINT, total_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    int mode = huge_page_mode();
+    size_t huge_size = (total_size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    mapping_size = total_size;
+    segment_start = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (mode == HUGE_HUGETLB) {
+        segment_start = mmap(HEAP_START_HINT, huge_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+        mapping_size = huge_size;
+    }
+#endif
+    if (segment_start == MAP_FAILED && mode != HUGE_OFF) {
+        // Whole huge pages, so the end of the heap gets them too
+        segment_start = map_aligned(huge_size);
+        mapping_size = huge_size;
+        if (segment_start != MAP_FAILED) {
+            size_t advised = huge_size;
+            if (mode == HUGE_HOT) {
+                const char *hot = getenv("HEAP_HOT_REGION");
+                size_t hot_size = (hot != NULL && atol(hot) > 0) ? (size_t)atol(hot) : DEFAULT_HOT_REGION;
+                hot_size = (hot_size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+                advised = (hot_size < huge_size) ? hot_size : huge_size;
+            }
+#ifdef MADV_HUGEPAGE
+            madvise(segment_start, advised, MADV_HUGEPAGE);  // only a hint, failure is fine
+#endif
+        }
+    }
+    if (segment_start == MAP_FAILED) {
+        segment_start = mmap(HEAP_START_HINT, total_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        mapping_size = total_size;
+    }
     assert(segment_start != MAP_FAILED);
     segment_size = total_size;
     return segment_start;
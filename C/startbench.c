@@ -0,0 +1,100 @@
+/*  Microbenchmark for process startup-to-exit time, for tools such as
+ *  myprintenv that run many times in startup scripts. Runs a command
+ *  repeatedly (fork, exec, wait) with its output sent to /dev/null, and
+ *  prints the minimum, median and mean wall time of a run.
+ *
+ *  Build:  gcc -std=gnu99 -O2 -o startbench startbench.c
+ *  Usage:  ./startbench [-n RUNS] COMMAND [ARG ...]
+ *  e.g.    ./startbench -n 5000 ./myprintenv HOME USER SHELL
+ */
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_RUNS 1000
+#define WARMUP_RUNS 10  // not timed, to fault in the page cache
+
+/*  Function returns the current monotonic time in nanoseconds
+ */
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*  Function runs argv once with stdout on devnull and returns the time from
+ *  fork until the child has been reaped, in nanoseconds
+ */
+long long run_once(char *argv[], int devnull) {
+    long long start = now_ns();
+    pid_t pid = fork();
+    if (pid == -1) {
+        error(1, errno, "fork");
+    }
+    if (pid == 0) {
+        dup2(devnull, STDOUT_FILENO);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            error(1, errno, "waitpid");
+        }
+    }
+    long long elapsed = now_ns() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+        error(1, 0, "cannot run '%s'", argv[0]);
+    }
+    return elapsed;
+}
+
+int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+    int runs = DEFAULT_RUNS;
+    int opt;
+    while ((opt = getopt(argc, argv, "+n:")) != -1) {
+        if (opt == 'n' && atoi(optarg) > 0) {
+            runs = atoi(optarg);
+        } else {
+            error(1, 0, "usage: %s [-n RUNS] COMMAND [ARG ...]", argv[0]);
+        }
+    }
+    if (optind == argc) {
+        error(1, 0, "usage: %s [-n RUNS] COMMAND [ARG ...]", argv[0]);
+    }
+
+    int devnull = open("/dev/null", O_WRONLY);
+    long long *times = malloc(runs * sizeof(long long));
+    if (devnull == -1 || times == NULL) {
+        error(1, errno, "setup");
+    }
+    for (int i = 0; i < WARMUP_RUNS; i++) {
+        run_once(argv + optind, devnull);
+    }
+    long long total = 0;
+    for (int i = 0; i < runs; i++) {
+        times[i] = run_once(argv + optind, devnull);
+        total += times[i];
+    }
+    qsort(times, runs, sizeof(long long), cmp_ll);
+
+    printf("%d runs of %s\n", runs, argv[optind]);
+    printf("min    %8.1f us\n", times[0] / 1000.0);
+    printf("median %8.1f us\n", times[runs / 2] / 1000.0);
+    printf("mean   %8.1f us\n", total / 1000.0 / runs);
+    free(times);
+    close(devnull);
+    return 0;
+}
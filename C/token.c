@@ -0,0 +1,180 @@
+/*  Tokenizer engine: delimiter sets compiled to a lookup table, a span
+ *  iterator over known-length input, and scan_token built on top of them.
+ *  With SSE2 and at most TOKEN_VECTOR_DELIMS delimiters, 16 input bytes
+ *  are classified at once by comparing them against each delimiter;
+ *  otherwise bytes are looked up in the table one at a time.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "token.h"
+#include "samples/prototypes.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define VECTOR_SIZE 16
+#define CACHED_DELIMS_MAX 64  // longest delimiter string scan_token caches
+
+void delimset_init(delimset *set, const char *delimiters) {
+    memset(set, 0, sizeof(*set));
+    for (const unsigned char *p = (const unsigned char *)delimiters; *p != '\0'; p++) {
+        if (delimset_contains(set, *p)) {
+            continue;
+        }
+        set->table[*p >> 3] |= 1 << (*p & 7);
+        if (set->nchars >= 0 && set->nchars < TOKEN_VECTOR_DELIMS) {
+            set->chars[set->nchars++] = *p;
+        } else {
+            set->nchars = -1;
+        }
+    }
+}
+
+#ifdef __SSE2__
+/*  Function returns a 16-bit mask of the bytes of block that are
+ *  delimiters, given the delimiters broadcast into delims
+ */
+static inline unsigned delim_mask(__m128i block, const __m128i delims[], int ndelims) {
+    __m128i match = _mm_setzero_si128();
+    for (int i = 0; i < ndelims; i++) {
+        match = _mm_or_si128(match, _mm_cmpeq_epi8(block, delims[i]));
+    }
+    return _mm_movemask_epi8(match);
+}
+#endif
+
+/*  Function returns the index of the first of the len bytes at p that is
+ *  (want_delim) or is not (!want_delim) a delimiter, or len
+ */
+static size_t find_class(const delimset *set, const char *p, size_t len, bool want_delim) {
+    size_t i = 0;
+#ifdef __SSE2__
+    if (set->nchars >= 0) {
+        __m128i delims[TOKEN_VECTOR_DELIMS];
+        for (int j = 0; j < set->nchars; j++) {
+            delims[j] = _mm_set1_epi8(set->chars[j]);
+        }
+        unsigned flip = want_delim ? 0 : 0xFFFF;
+        for (; i + VECTOR_SIZE <= len; i += VECTOR_SIZE) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(p + i));
+            unsigned hits = delim_mask(block, delims, set->nchars) ^ flip;
+            if (hits != 0) {
+                return i + __builtin_ctz(hits);
+            }
+        }
+    }
+#endif
+    while (i < len && delimset_contains(set, p[i]) != want_delim) {
+        i++;
+    }
+    return i;
+}
+
+size_t delimset_find(const delimset *set, const char *p, size_t len) {
+    return find_class(set, p, len, true);
+}
+
+size_t delimset_skip(const delimset *set, const char *p, size_t len) {
+    return find_class(set, p, len, false);
+}
+
+/*  Function returns the first byte from p on that is '\0' or is (want_delim)
+ *  or is not (!want_delim) a delimiter, looking at most limit bytes ahead.
+ *  The vector path only loads aligned blocks, which cannot cross into an
+ *  unmapped page past the terminator.
+ */
+static const char *find_class_cstr(const delimset *set, const char *p, size_t limit, bool want_delim) {
+#ifdef __SSE2__
+    if (set->nchars >= 0) {
+        __m128i delims[TOKEN_VECTOR_DELIMS];
+        for (int j = 0; j < set->nchars; j++) {
+            delims[j] = _mm_set1_epi8(set->chars[j]);
+        }
+        unsigned flip = want_delim ? 0 : 0xFFFF;
+        size_t misalign = (uintptr_t)p & (VECTOR_SIZE - 1);
+        const char *block_start = p - misalign;
+        unsigned valid = (0xFFFF << misalign) & 0xFFFF;  // bytes at or after p
+        while (true) {
+            __m128i block = _mm_load_si128((const __m128i *)block_start);
+            unsigned nuls = _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_setzero_si128()));
+            unsigned hits = ((delim_mask(block, delims, set->nchars) ^ flip) | nuls) & valid;
+            if (hits != 0) {
+                size_t found = block_start + __builtin_ctz(hits) - p;
+                return p + ((found < limit) ? found : limit);
+            }
+            block_start += VECTOR_SIZE;
+            if ((size_t)(block_start - p) >= limit) {
+                return p + limit;
+            }
+            valid = 0xFFFF;
+        }
+    }
+#endif
+    size_t i = 0;
+    while (i < limit && p[i] != '\0' && delimset_contains(set, p[i]) != want_delim) {
+        i++;
+    }
+    return p + i;
+}
+
+void token_iter_init(token_iter *it, const char *input, size_t len, const delimset *set) {
+    it->p = input;
+    it->end = input + len;
+    it->set = set;
+}
+
+bool token_iter_next(token_iter *it, token_span *span) {
+    it->p += delimset_skip(it->set, it->p, it->end - it->p);
+    if (it->p == it->end) {
+        return false;
+    }
+    span->ptr = it->p;
+    span->len = delimset_find(it->set, it->p, it->end - it->p);
+    it->p += span->len;
+    return true;
+}
+
+/*  Function returns the compiled set for delimiters. The last set used by
+ *  this thread is kept, since callers scan many tokens with the same one.
+ */
+static const delimset *cached_delimset(const char *delimiters, delimset *scratch) {
+    static __thread char cached_delims[CACHED_DELIMS_MAX];
+    static __thread delimset cached_set;
+    static __thread bool cached;
+
+    size_t len = strlen(delimiters);
+    if (len >= CACHED_DELIMS_MAX) {
+        delimset_init(scratch, delimiters);
+        return scratch;
+    }
+    if (!cached || strcmp(cached_delims, delimiters) != 0) {
+        memcpy(cached_delims, delimiters, len + 1);
+        delimset_init(&cached_set, delimiters);
+        cached = true;
+    }
+    return &cached_set;
+}
+
+/*  Function skips delimiters at *p_input and copies the token after them
+ *  into buf (truncated to buflen - 1 characters, the rest is left for the
+ *  next call). *p_input is advanced past the copied characters. Returns
+ *  false if there is no token left, or if buf has no room for one
+ *  character and its '\0' (callers looping until false would never advance).
+ */
+bool scan_token(const char **p_input, const char *delimiters, char buf[], size_t buflen) {
+    delimset scratch;
+    const delimset *set = cached_delimset(delimiters, &scratch);
+
+    const char *start = find_class_cstr(set, *p_input, SIZE_MAX, false);
+    if (*start == '\0' || buflen < 2) {
+        *p_input = start;
+        return false;
+    }
+    size_t len = find_class_cstr(set, start, buflen - 1, true) - start;
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    *p_input = start + len;
+    return true;
+}
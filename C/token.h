@@ -0,0 +1,66 @@
+/* File: token.h
+ * -------------
+ * Tokenizer engine behind scan_token. A delimiter set is compiled once
+ * into a 256-bit lookup table (and, for a few delimiters, a list the
+ * SSE2 classifier compares 16 bytes at a time against), then tokens are
+ * handed out as spans (pointer and length) into the input, without
+ * copying them.
+ */
+
+#ifndef _token_h
+#define _token_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TOKEN_VECTOR_DELIMS 8  // most delimiters the vector classifier handles
+
+typedef struct delimset {
+    unsigned char table[32];  // bit c is set if byte c is a delimiter
+    unsigned char chars[TOKEN_VECTOR_DELIMS];
+    int nchars;  // distinct delimiters in chars, or -1 if there are too many
+} delimset;
+
+typedef struct token_span {
+    const char *ptr;
+    size_t len;
+} token_span;
+
+typedef struct token_iter {
+    const char *p;
+    const char *end;
+    const delimset *set;
+} token_iter;
+
+/* Compiles the delimiters of the string delimiters into set.
+ */
+void delimset_init(delimset *set, const char *delimiters);
+
+/* Returns true if byte c is one of the set's delimiters.
+ */
+static inline bool delimset_contains(const delimset *set, unsigned char c) {
+    return (set->table[c >> 3] >> (c & 7)) & 1;
+}
+
+/* Returns the index of the first delimiter in the len bytes at p, or len
+ * if there is none.
+ */
+size_t delimset_find(const delimset *set, const char *p, size_t len);
+
+/* Returns the index of the first byte that is not a delimiter in the len
+ * bytes at p, or len if there is none.
+ */
+size_t delimset_skip(const delimset *set, const char *p, size_t len);
+
+/* Starts iterating over the tokens of the len bytes at input. Bytes are
+ * not interpreted otherwise, so the input may hold '\0's. The input and
+ * set must outlive the iterator.
+ */
+void token_iter_init(token_iter *it, const char *input, size_t len, const delimset *set);
+
+/* Stores the next token (a maximal run of non-delimiters) in *span and
+ * returns true, or returns false when there are no tokens left.
+ */
+bool token_iter_next(token_iter *it, token_span *span);
+
+#endif